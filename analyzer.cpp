@@ -1,23 +1,80 @@
 #include "analyzer.hpp"
 #include "bytefile.hpp"
 
+#include "assertions.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
 #include <cstring>
+#include <thread>
+#include <vector>
+
+/**
+ * Both arrays are fresh mappings, which are already empty.
+ * Even a tiny memory limit leaves room for `min_hashtable_size` entries.
+ */
+hashtable::hashtable(offset_t size, offset_t max_size)
+    : size(std::clamp(size, min_hashtable_size, std::max(max_size, min_hashtable_size))),
+      max_size(std::max(max_size, min_hashtable_size)),
+      entries(allocate_zeroed<hashtable_entry>(this->size)),
+      short_entries(allocate_zeroed<hashtable_entry>(short_entries_count))
+{
+}
+
+atomic_bitset::atomic_bitset(size_t size)
+    : words(allocate_zeroed<std::atomic<uint64_t>>((size + 63) / 64))
+{
+}
+
+void work_deque::push(offset_t ip)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    items.push_back(ip);
+}
+
+bool work_deque::pop(offset_t& ip)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (items.empty())
+    {
+        return false;
+    }
+    ip = items.back();
+    items.pop_back();
+    return true;
+}
 
-hashtable::hashtable(uint32_t size) : size(size), entries(new hashtable_entry[size]())
+bool work_deque::steal(offset_t& ip)
 {
-    for (uint32_t i = 0; i < size; i++)
+    std::lock_guard<std::mutex> lock(mutex);
+    if (items.empty())
     {
-        entries[i].key.length = 0;
+        return false;
     }
+    ip = items.front();
+    items.pop_front();
+    return true;
 }
 
-bool equals(uint8_t* code_ptr, hashtable_key const& key, uint32_t ip, uint32_t length)
+bool equals(
+    uint8_t* code_ptr, hashtable_key const& key, uint32_t hash, offset_t ip, uint32_t length
+)
 {
-    if (key.length != length)
+    if (key.hash != hash || key.length != length)
     {
         return false;
     }
+#ifdef INLINE_KEYS
+    uint32_t inline_length = std::min(length, inline_key_length);
+    if (memcmp(key.bytes, code_ptr + ip, inline_length) != 0)
+    {
+        return false;
+    }
+    for (uint32_t i = inline_length; i < length; ++i)
+#else
     for (uint32_t i = 0; i < length; ++i)
+#endif
     {
         if (code_ptr[key.ip + i] != code_ptr[ip + i])
         {
@@ -27,66 +84,814 @@ bool equals(uint8_t* code_ptr, hashtable_key const& key, uint32_t ip, uint32_t l
     return true;
 }
 
-static hashtable_entry&
-get_entry(hashtable& hashtable, uint8_t* code_ptr, uint32_t hash, uint32_t ip, uint32_t length)
+/**
+ * Returns nullptr if the key isn't in the table and no slot is free.
+ */
+static hashtable_entry*
+get_entry(hashtable& hashtable, uint8_t* code_ptr, uint32_t hash, offset_t ip, uint32_t length)
 {
-    uint32_t index = (hash * mixing_constant) % hashtable.size;
-    while (true)
+    offset_t index = hashtable.home_index(hash);
+    for (uint64_t probes = 1; probes <= hashtable.size; ++probes)
     {
         if (hashtable.entries[index].key.length == 0)
         {
-            return hashtable.entries[index];
+            hashtable.stats.record_lookup(probes);
+            return &hashtable.entries[index];
         }
-        if (equals(code_ptr, hashtable.entries[index].key, ip, length))
+        bool is_equal = equals(code_ptr, hashtable.entries[index].key, hash, ip, length);
+        hashtable.stats.record_equals(is_equal);
+        if (is_equal)
         {
-            return hashtable.entries[index];
+            hashtable.stats.record_lookup(probes);
+            return &hashtable.entries[index];
         }
         index = (index + 1) % hashtable.size;
     }
+    return nullptr;
 }
 
-void hashtable::mark_occurrence(uint8_t* code_ptr, uint32_t hash, uint32_t ip, uint32_t length)
+/**
+ * The table grows before probing, so that a new key always finds a free slot.
+ * A full table at `max_size` still counts the keys it already holds.
+ */
+void hashtable::add_occurrences(
+    uint8_t* code_ptr, uint32_t hash, offset_t ip, uint32_t length, uint32_t occurrences
+)
 {
-    hashtable_entry& entry = get_entry(*this, code_ptr, hash, ip, length);
-    if (entry.key.length)
+    check_unpacked();
+    if (used >= size - size / 4 && size < max_size)
+    {
+        resize(std::min<uint64_t>(static_cast<uint64_t>(size) * 2, max_size));
+    }
+
+    hashtable_entry* entry = get_entry(*this, code_ptr, hash, ip, length);
+    if (entry != nullptr && entry->key.length)
+    {
+        if (!add_saturating(entry->value, occurrences))
+        {
+            is_saturated = true;
+        }
+        return;
+    }
+    if (entry == nullptr || used >= size - size / 4)
+    {
+        failure("The hashtable doesn't fit into the memory limit");
+    }
+
+    entry->key.ip = ip;
+    entry->key.length = length;
+    entry->key.hash = hash;
+#ifdef INLINE_KEYS
+    memcpy(entry->key.bytes, code_ptr + ip, std::min(length, inline_key_length));
+#endif
+    entry->value = occurrences;
+    ++used;
+}
+
+void hashtable::add_occurrences(
+    uint8_t* code_ptr, offset_t ip, uint32_t length, uint32_t occurrences
+)
+{
+    if (length <= short_key_length)
+    {
+        hashtable_entry& entry = short_entries[short_index(code_ptr + ip, length)];
+        if (entry.value == 0)
+        {
+            entry.key.ip = ip;
+            entry.key.length = length;
+        }
+        entry.value += occurrences;
+        return;
+    }
+    add_occurrences(code_ptr, hash_bytes(code_ptr + ip, length), ip, length, occurrences);
+}
+
+/**
+ * Calls `move(entry)` for the first `count` entries of `old_entries` in order,
+ * giving their pages back to the kernel a huge page at a time as they are moved.
+ */
+template <typename Entry, typename Move>
+static void move_entries(mapped_array<Entry> const& old_entries, offset_t count, Move const& move)
+{
+    constexpr offset_t chunk = std::max<size_t>(1, huge_page_size / sizeof(Entry));
+    uint8_t* old_bytes = reinterpret_cast<uint8_t*>(old_entries.get());
+    size_t released = 0;
+    for (offset_t begin = 0; begin < count; begin += std::min(chunk, count - begin))
+    {
+        offset_t end = begin + std::min(chunk, count - begin);
+        for (offset_t i = begin; i < end; ++i)
+        {
+            move(old_entries[i]);
+        }
+        size_t moved = end * sizeof(Entry) / huge_page_size * huge_page_size;
+        release_pages(old_bytes + released, moved - released);
+        released = moved;
+    }
+}
+
+bool hashtable::reserve(offset_t keys)
+{
+    check_unpacked();
+    uint64_t wanted_size = static_cast<uint64_t>(keys) + keys / 3 + 4;
+    if (wanted_size > size)
+    {
+        resize(std::min<uint64_t>(wanted_size, max_size));
+    }
+    return wanted_size <= size;
+}
+
+/**
+ * Since the keys are distinct and their hashes are stored,
+ * every entry is simply put into the first free slot after its new home
+ * without reading the code. As `home_index` is monotonic,
+ * the new slots are filled about in the order the old ones are given back,
+ * so the two tables together take about the memory of the new one.
+ */
+void hashtable::resize(offset_t new_size)
+{
+    mapped_array<hashtable_entry> old_entries = std::move(entries);
+    offset_t old_size = size;
+    entries = allocate_zeroed<hashtable_entry>(new_size);
+    size = new_size;
+    ++grows;
+
+    move_entries(
+        old_entries, old_size,
+        [this](hashtable_entry const& entry)
+        {
+            if (entry.key.length == 0)
+            {
+                return;
+            }
+            offset_t index = home_index(entry.key.hash);
+            while (entries[index].key.length != 0)
+            {
+                index = index + 1 == size ? 0 : index + 1;
+            }
+            entries[index] = entry;
+        }
+    );
+}
+
+void hashtable::fold_short_keys(uint8_t* code_ptr)
+{
+    for (uint32_t i = 0; i < short_entries_count; ++i)
     {
-        entry.value++;
+        hashtable_entry& entry = short_entries[i];
+        if (entry.value != 0)
+        {
+            add_occurrences(
+                code_ptr, hash_bytes(code_ptr + entry.key.ip, entry.key.length), entry.key.ip,
+                entry.key.length, entry.value
+            );
+            entry = hashtable_entry();
+        }
     }
-    else
+}
+
+instruction_ids::instruction_ids(offset_t size, offset_t max_size)
+    : size(size), max_size(max_size), slots(allocate_zeroed<slot>(size)),
+      short_ids(allocate_zeroed<uint32_t>(short_entries_count)),
+      instructions(allocate_zeroed<instruction>(size))
+{
+}
+
+offset_t instruction_ids::free_index(uint32_t hash) const
+{
+    offset_t index = home_index(hash);
+    while (slots[index].id != 0)
+    {
+        index = index + 1 == size ? 0 : index + 1;
+    }
+    return index;
+}
+
+/**
+ * The short instructions take room among the instructions without using a slot,
+ * so the slots never get fuller than the instructions.
+ */
+uint32_t instruction_ids::add(offset_t ip, uint32_t length)
+{
+    if (count >= size - size / 4)
     {
-        entry.key.ip = ip;
-        entry.key.length = length;
-        entry.value = 1;
+        if (size == max_size)
+        {
+            failure("The instruction IDs don't fit into the memory limit");
+        }
+        resize(std::min<uint64_t>(static_cast<uint64_t>(size) * 2, max_size));
     }
+    instructions[count] = {ip, length, 1};
+    return count++;
 }
 
-uint32_t hashtable::pack()
+/**
+ * Grows like `hashtable::resize`.
+ */
+void instruction_ids::resize(offset_t new_size)
 {
-    uint32_t packed_pointer = 0;
-    uint32_t unpacked_pointer = 0;
+    mapped_array<instruction> old_instructions = std::move(instructions);
+    instructions = allocate_zeroed<instruction>(new_size);
+    instruction* next = instructions.get();
+    move_entries(
+        old_instructions, count, [&next](instruction const& old) { *next++ = old; }
+    );
+
+    mapped_array<slot> old_slots = std::move(slots);
+    offset_t old_size = size;
+    slots = allocate_zeroed<slot>(new_size);
+    size = new_size;
+    move_entries(
+        old_slots, old_size,
+        [this](slot const& old)
+        {
+            if (old.id != 0)
+            {
+                slots[free_index(old.hash)] = old;
+            }
+        }
+    );
+}
 
-    while (unpacked_pointer < size)
+pair_table::pair_table(offset_t size, offset_t max_size)
+    : size(size), max_size(max_size), entries(allocate_zeroed<pair_entry>(size))
+{
+}
+
+void pair_table::add(offset_t free_index, uint64_t ids, offset_t ip)
+{
+    if (used >= size - size / 4)
     {
-        hashtable_entry& packed_entry = entries[packed_pointer];
-        hashtable_entry& unpacked_entry = entries[unpacked_pointer];
+        if (size == max_size)
+        {
+            failure("The pair table doesn't fit into the memory limit");
+        }
+        resize(std::min<uint64_t>(static_cast<uint64_t>(size) * 2, max_size));
+        free_index = home_index(ids);
+        while (entries[free_index].value != 0)
+        {
+            free_index = (free_index + 1) % size;
+        }
+    }
 
-        if (packed_entry.key.length == 0 && unpacked_entry.key.length != 0)
+    entries[free_index].ids = ids;
+    entries[free_index].ip = ip;
+    entries[free_index].value = 1;
+    ++used;
+}
+
+/**
+ * Grows like `hashtable::resize`.
+ */
+void pair_table::resize(offset_t new_size)
+{
+    mapped_array<pair_entry> old_entries = std::move(entries);
+    offset_t old_size = size;
+    entries = allocate_zeroed<pair_entry>(new_size);
+    size = new_size;
+
+    move_entries(
+        old_entries, old_size,
+        [this](pair_entry const& entry)
         {
-            packed_entry = unpacked_entry;
-            unpacked_entry.key.length = 0;
-            packed_pointer++;
-            unpacked_pointer++;
+            if (entry.value == 0)
+            {
+                return;
+            }
+            offset_t index = home_index(entry.ids);
+            while (entries[index].value != 0)
+            {
+                index = index + 1 == size ? 0 : index + 1;
+            }
+            entries[index] = entry;
         }
-        else if (packed_entry.key.length == 0)
+    );
+}
+
+/**
+ * A key is never both an instruction and a pair of them,
+ * since no instruction is the beginning of another one.
+ */
+void add_pair_counts(
+    hashtable& table, uint8_t* code_ptr, instruction_ids const& ids, pair_table const& pairs
+)
+{
+    table.reserve(ids.count + pairs.used);
+    for (uint32_t id = 0; id < ids.count; ++id)
+    {
+        instruction_ids::instruction const& instruction = ids.instructions[id];
+        table.add_occurrences(code_ptr, instruction.ip, instruction.length, instruction.count);
+    }
+    for (offset_t i = 0; i < pairs.size; ++i)
+    {
+        pair_entry const& entry = pairs.entries[i];
+        if (entry.value != 0)
         {
-            unpacked_pointer++;
+            uint32_t length = ids.instructions[entry.ids >> 32].length +
+                              ids.instructions[entry.ids & UINT32_MAX].length;
+            table.add_occurrences(code_ptr, entry.ip, length, entry.value);
         }
-        else
+    }
+}
+
+/**
+ * Since all keys are distinct, none of them has to be hashed or compared.
+ */
+void pack_pair_counts(hashtable& table, instruction_ids const& ids, pair_table const& pairs)
+{
+    table.check_unpacked();
+    uint64_t keys = static_cast<uint64_t>(ids.count) + pairs.used;
+    if (keys > table.max_size)
+    {
+        failure("The hashtable doesn't fit into the memory limit");
+    }
+    if (keys > table.size)
+    {
+        table = hashtable(static_cast<offset_t>(keys), table.max_size);
+    }
+
+    hashtable_entry* packed = table.entries.get();
+    for (uint32_t id = 0; id < ids.count; ++id)
+    {
+        instruction_ids::instruction const& instruction = ids.instructions[id];
+        packed->key.ip = instruction.ip;
+        packed->key.length = instruction.length;
+        packed->value = instruction.count;
+        ++packed;
+    }
+    for (offset_t i = 0; i < pairs.size; ++i)
+    {
+        pair_entry const& entry = pairs.entries[i];
+        if (entry.value != 0)
         {
-            packed_pointer++;
-            unpacked_pointer++;
+            packed->key.ip = entry.ip;
+            packed->key.length = ids.instructions[entry.ids >> 32].length +
+                                 ids.instructions[entry.ids & UINT32_MAX].length;
+            packed->value = entry.value;
+            ++packed;
         }
     }
+    table.used = static_cast<offset_t>(keys);
+    table.is_packed = true;
+}
 
-    return packed_pointer;
+/**
+ * Runs `work(part)` for every part in [0, parts), each on its own thread.
+ */
+template <typename Work>
+static void run_parts(unsigned parts, Work const& work)
+{
+    std::vector<std::thread> workers;
+    for (unsigned part = 1; part < parts; ++part)
+    {
+        workers.emplace_back(work, part);
+    }
+    work(0);
+    for (std::thread& worker : workers)
+    {
+        worker.join();
+    }
+}
+
+/**
+ * Slices of fewer entries are not worth a thread.
+ */
+constexpr offset_t min_parallel_slice = 1 << 16;
+
+/**
+ * Every thread compacts its own slice of the table to the start of the slice,
+ * and the compacted slices are then moved down after each other,
+ * so the keys stay in the order of their slots for any number of threads.
+ * The empty rest of the table is given back before the entries are sorted.
+ */
+offset_t hashtable::pack(unsigned threads)
+{
+    threads = std::max(1u, std::min<unsigned>(threads, size / min_parallel_slice));
+    auto slice_begin = [this, threads](unsigned part)
+    { return static_cast<offset_t>(static_cast<uint64_t>(size) * part / threads); };
+
+    std::vector<offset_t> kept(threads);
+    run_parts(
+        threads,
+        [&](unsigned part)
+        {
+            offset_t begin = slice_begin(part);
+            offset_t end = slice_begin(part + 1);
+            offset_t packed = begin;
+            for (offset_t i = begin; i < end; ++i)
+            {
+                if (entries[i].key.length != 0)
+                {
+                    if (i != packed)
+                    {
+                        entries[packed] = entries[i];
+                        entries[i].key.length = 0;
+                    }
+                    ++packed;
+                }
+            }
+            kept[part] = packed - begin;
+        }
+    );
+
+    offset_t packed_size = 0;
+    for (unsigned part = 0; part < threads; ++part)
+    {
+        memmove(
+            &entries[packed_size], &entries[slice_begin(part)], kept[part] * sizeof(hashtable_entry)
+        );
+        packed_size += kept[part];
+    }
+    // The moved slices are left behind where nothing has been moved over them.
+    for (unsigned part = 0; part < threads; ++part)
+    {
+        offset_t end = slice_begin(part) + kept[part];
+        for (offset_t i = std::max(slice_begin(part), packed_size); i < end; ++i)
+        {
+            entries[i].key.length = 0;
+        }
+    }
+    release_pages(&entries[packed_size], (size - packed_size) * sizeof(hashtable_entry));
+    is_packed = true;
+    return packed_size;
+}
+
+/**
+ * Shorter ranges are sorted by comparisons.
+ */
+constexpr size_t min_radix_sort_size = 1 << 16;
+
+/**
+ * A stable LSD radix sort by the bytes of the count, the offset and the length,
+ * which is the order of `hashtable_entry::operator<`. The bytes that are the same
+ * in all entries, such as the high bytes of small counts, take no pass.
+ * Every thread distributes its own chunk of the entries,
+ * starting from the positions left to it by the chunks before it.
+ */
+void sort_entries(hashtable_entry* begin, hashtable_entry* end, unsigned threads)
+{
+    size_t count = end - begin;
+    if (count < min_radix_sort_size)
+    {
+        std::sort(begin, end);
+        return;
+    }
+    threads = std::max<size_t>(1, std::min<size_t>(threads, count / min_radix_sort_size));
+
+    // The least significant byte of the key first, the entries being little-endian.
+    std::vector<size_t> digits;
+    for (size_t i = 0; i < sizeof(uint32_t); ++i)
+    {
+        digits.push_back(offsetof(hashtable_entry, key.length) + i);
+    }
+    for (size_t i = 0; i < sizeof(offset_t); ++i)
+    {
+        digits.push_back(offsetof(hashtable_entry, key.ip) + i);
+    }
+    for (size_t i = 0; i < sizeof(uint32_t); ++i)
+    {
+        digits.push_back(offsetof(hashtable_entry, value) + i);
+    }
+
+    using histogram = std::array<size_t, 256>;
+    auto chunk_begin = [count, threads](unsigned part) { return count * part / threads; };
+    auto count_digits = [&](hashtable_entry const* entries, std::vector<size_t> const& offsets,
+                            std::vector<histogram>& histograms)
+    {
+        histograms.assign(threads * offsets.size(), histogram{});
+        run_parts(
+            threads,
+            [&](unsigned part)
+            {
+                for (size_t i = chunk_begin(part); i < chunk_begin(part + 1); ++i)
+                {
+                    uint8_t const* bytes = reinterpret_cast<uint8_t const*>(&entries[i]);
+                    for (size_t digit = 0; digit < offsets.size(); ++digit)
+                    {
+                        ++histograms[part * offsets.size() + digit][bytes[offsets[digit]]];
+                    }
+                }
+            }
+        );
+    };
+
+    std::vector<histogram> histograms;
+    count_digits(begin, digits, histograms);
+    std::vector<size_t> passes;
+    for (size_t digit = 0; digit < digits.size(); ++digit)
+    {
+        histogram total{};
+        for (unsigned part = 0; part < threads; ++part)
+        {
+            for (unsigned byte = 0; byte < 256; ++byte)
+            {
+                total[byte] += histograms[part * digits.size() + digit][byte];
+            }
+        }
+        if (std::find(total.begin(), total.end(), count) == total.end())
+        {
+            passes.push_back(digit);
+        }
+    }
+
+    mapped_array<hashtable_entry> scratch = allocate_zeroed<hashtable_entry>(count);
+    hashtable_entry* source = begin;
+    hashtable_entry* destination = scratch.get();
+    for (size_t pass : passes)
+    {
+        size_t offset = digits[pass];
+        size_t histogram_index = pass;
+        size_t histogram_stride = digits.size();
+        // With a single chunk, the counts over all entries don't depend on their order.
+        if (threads > 1 && pass != passes.front())
+        {
+            count_digits(source, {offset}, histograms);
+            histogram_index = 0;
+            histogram_stride = 1;
+        }
+
+        std::vector<histogram> positions(threads);
+        size_t position = 0;
+        for (unsigned byte = 0; byte < 256; ++byte)
+        {
+            for (unsigned part = 0; part < threads; ++part)
+            {
+                positions[part][byte] = position;
+                position += histograms[part * histogram_stride + histogram_index][byte];
+            }
+        }
+        run_parts(
+            threads,
+            [&](unsigned part)
+            {
+                histogram& next = positions[part];
+                for (size_t i = chunk_begin(part); i < chunk_begin(part + 1); ++i)
+                {
+                    uint8_t byte = reinterpret_cast<uint8_t const*>(&source[i])[offset];
+                    destination[next[byte]++] = source[i];
+                }
+            }
+        );
+        std::swap(source, destination);
+    }
+
+    if (source != begin)
+    {
+        run_parts(
+            threads,
+            [&](unsigned part)
+            {
+                std::copy(
+                    source + chunk_begin(part), source + chunk_begin(part + 1),
+                    begin + chunk_begin(part)
+                );
+            }
+        );
+    }
+}
+
+/**
+ * Finds the entry for the given key, probing only the slots in [begin, end).
+ * Returns nullptr if the probing leaves this window.
+ * The lookup is recorded in `stats`, since other threads probe the same table.
+ */
+static hashtable_entry* get_entry_within(
+    hashtable& hashtable, uint8_t* code_ptr, uint32_t hash, offset_t ip, uint32_t length,
+    offset_t begin, offset_t end, probe_stats& stats
+)
+{
+    uint64_t probes = 1;
+    for (offset_t index = hashtable.home_index(hash); index >= begin && index < end;
+         ++index, ++probes)
+    {
+        if (hashtable.entries[index].key.length == 0)
+        {
+            stats.record_lookup(probes);
+            return &hashtable.entries[index];
+        }
+        bool is_equal = equals(code_ptr, hashtable.entries[index].key, hash, ip, length);
+        stats.record_equals(is_equal);
+        if (is_equal)
+        {
+            stats.record_lookup(probes);
+            return &hashtable.entries[index];
+        }
+    }
+    return nullptr;
+}
+
+/**
+ * Returns true if the key is new.
+ */
+static bool merge_entry(hashtable_entry& entry, hashtable_entry const& source)
+{
+    if (entry.key.length)
+    {
+        entry.value += source.value;
+        return false;
+    }
+    entry = source;
+    return true;
+}
+
+/**
+ * Since `home_index` is monotonic in the mixed hash,
+ * the keys whose destination home lies in one slot window
+ * form a contiguous range of mixed hashes. This range maps
+ * to a contiguous slot window in every source table as well.
+ *
+ * Each merging thread owns one destination window.
+ * It scans the corresponding source windows
+ * (plus the probing runs spilling past their ends),
+ * and inserts the keys without leaving its own window.
+ * The keys whose probing would leave it are inserted afterwards.
+ *
+ * The destination can't grow while the threads work,
+ * so it is grown beforehand to hold all the source keys.
+ * If the memory limit doesn't allow that, the merge is serial.
+ */
+void merge_hashtables(
+    hashtable& destination, std::vector<hashtable> const& sources, uint8_t* code_ptr,
+    unsigned threads
+)
+{
+    destination.check_unpacked();
+    for (hashtable const& source : sources)
+    {
+        source.check_unpacked();
+        destination.stats.add(source.stats);
+        for (uint32_t i = 0; i < short_entries_count; ++i)
+        {
+            if (source.short_entries[i].value != 0)
+            {
+                merge_entry(destination.short_entries[i], source.short_entries[i]);
+            }
+        }
+    }
+
+    offset_t source_keys = 0;
+    for (hashtable const& source : sources)
+    {
+        source_keys += source.used;
+    }
+    if (!destination.reserve(destination.used + source_keys))
+    {
+        for (hashtable const& source : sources)
+        {
+            for (offset_t i = 0; i < source.size; ++i)
+            {
+                hashtable_entry const& entry = source.entries[i];
+                if (entry.key.length != 0)
+                {
+                    destination.add_occurrences(
+                        code_ptr, entry.key.hash, entry.key.ip, entry.key.length, entry.value
+                    );
+                }
+            }
+        }
+        return;
+    }
+
+    auto window_begin = [&](unsigned part)
+    { return static_cast<offset_t>(static_cast<uint64_t>(destination.size) * part / threads); };
+    auto first_mixed_hash = [&](unsigned part)
+    {
+        offset_t begin = window_begin(part);
+        uint64_t low = 0;
+        uint64_t high = uint64_t(1) << 32;
+        while (low < high)
+        {
+            uint64_t middle = (low + high) / 2;
+            if (destination.slot_of(middle) < begin)
+            {
+                low = middle + 1;
+            }
+            else
+            {
+                high = middle;
+            }
+        }
+        return low;
+    };
+
+    std::vector<std::vector<hashtable_entry>> postponed(threads);
+    std::vector<offset_t> inserted(threads, 0);
+    std::vector<probe_stats> stats(threads);
+    std::vector<std::thread> workers;
+    for (unsigned part = 0; part < threads; ++part)
+    {
+        workers.emplace_back(
+            [&, part]()
+            {
+                offset_t begin = window_begin(part);
+                offset_t end = window_begin(part + 1);
+                uint64_t mixed_begin = first_mixed_hash(part);
+                uint64_t mixed_end = first_mixed_hash(part + 1);
+                if (mixed_begin >= mixed_end)
+                {
+                    return;
+                }
+
+                for (hashtable const& source : sources)
+                {
+                    offset_t index = source.slot_of(mixed_begin);
+                    offset_t window = source.slot_of(mixed_end - 1) - index;
+                    for (offset_t scanned = 0; scanned < source.size; ++scanned)
+                    {
+                        hashtable_entry const& entry = source.entries[index];
+                        if (entry.key.length == 0 && scanned > window)
+                        {
+                            break;
+                        }
+                        if (entry.key.length != 0)
+                        {
+                            uint32_t hash = entry.key.hash;
+                            offset_t home = destination.home_index(hash);
+                            if (home >= begin && home < end)
+                            {
+                                hashtable_entry* target = get_entry_within(
+                                    destination, code_ptr, hash, entry.key.ip, entry.key.length,
+                                    begin, end, stats[part]
+                                );
+                                if (target != nullptr)
+                                {
+                                    inserted[part] += merge_entry(*target, entry);
+                                }
+                                else
+                                {
+                                    postponed[part].push_back(entry);
+                                }
+                            }
+                        }
+                        index = index + 1 == source.size ? 0 : index + 1;
+                    }
+                }
+            }
+        );
+    }
+    for (std::thread& worker : workers)
+    {
+        worker.join();
+    }
+
+    for (offset_t keys : inserted)
+    {
+        destination.used += keys;
+    }
+    for (probe_stats const& part_stats : stats)
+    {
+        destination.stats.add(part_stats);
+    }
+
+    for (std::vector<hashtable_entry> const& entries : postponed)
+    {
+        for (hashtable_entry const& entry : entries)
+        {
+            destination.add_occurrences(
+                code_ptr, entry.key.hash, entry.key.ip, entry.key.length, entry.value
+            );
+        }
+    }
+}
+
+uint64_t opcode_counts::size(unsigned opcode_count, unsigned max_length)
+{
+    uint64_t size = 0;
+    uint64_t of_length = 1;
+    for (unsigned length = 1; length <= max_length; ++length)
+    {
+        if (of_length > UINT64_MAX / opcode_count / max_sequence_length)
+        {
+            return UINT64_MAX;
+        }
+        of_length *= opcode_count;
+        size += of_length;
+    }
+    return size;
+}
+
+opcode_counts::opcode_counts(unsigned opcode_count, unsigned max_length)
+    : opcode_count(opcode_count), max_length(max_length)
+{
+    uint64_t of_length = 1;
+    offsets[1] = 0;
+    for (unsigned length = 1; length <= max_length; ++length)
+    {
+        of_length *= opcode_count;
+        offsets[length + 1] = offsets[length] + of_length;
+    }
+    counts = allocate_zeroed<uint32_t>(offsets[max_length + 1]);
+}
+
+void opcode_counts::add(opcode_counts const& other)
+{
+    uint64_t size = offsets[max_length + 1];
+    uint32_t* destination = counts.get();
+    uint32_t const* source = other.counts.get();
+    for (uint64_t i = 0; i < size; ++i)
+    {
+        if (!add_saturating(destination[i], source[i]))
+        {
+            is_saturated = true;
+        }
+    }
 }
@@ -3,37 +3,94 @@
 
 #include "assertions.hpp"
 #include "bytefile.hpp"
+#include "memory.hpp"
+#include "report.hpp"
+#include "stats.hpp"
 
 #include <algorithm>
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
 #include <cstdio>
+#include <cstring>
+#include <deque>
 #include <initializer_list>
+#include <limits>
 #include <memory>
+#include <mutex>
+#include <thread>
+#include <tuple>
 #include <vector>
 
-constexpr uint32_t hash_initial = 0x811C9DC5;
-constexpr uint32_t hash_prime = 0x01000193;
+constexpr uint64_t hash_multiplier = 0x9E3779B97F4A7C15;
 constexpr uint32_t mixing_constant = 0x9E3779B9;
 
-inline void update_hash(uint32_t& hash, uint8_t byte)
+constexpr offset_t no_target = std::numeric_limits<offset_t>::max();
+constexpr offset_t no_limit = std::numeric_limits<offset_t>::max();
+
+inline uint64_t load_uint64_t(uint8_t const* bytes)
+{
+    uint64_t word;
+    memcpy(&word, bytes, sizeof(word));
+    return word;
+}
+
+inline uint32_t load_uint32_t(uint8_t const* bytes)
 {
-    hash = (hash ^ byte) * hash_prime;
+    uint32_t word;
+    memcpy(&word, bytes, sizeof(word));
+    return word;
+}
+
+/**
+ * Hashes a key 8 bytes at a time, with a multiplication per word.
+ * The last word ends at the end of the key and may overlap the one before it,
+ * and the keys under 8 bytes are read as two overlapping halves,
+ * so nothing is read outside the key. The length is hashed as well,
+ * so the overlaps don't make different keys collide any more than otherwise.
+ */
+inline uint32_t hash_bytes(uint8_t const* bytes, uint32_t length)
+{
+    uint64_t hash = length * hash_multiplier;
+    if (length >= 8)
+    {
+        for (uint32_t i = 0; i + 8 < length; i += 8)
+        {
+            hash = (hash ^ load_uint64_t(bytes + i)) * hash_multiplier;
+        }
+        hash = (hash ^ load_uint64_t(bytes + length - 8)) * hash_multiplier;
+    }
+    else if (length >= 4)
+    {
+        uint64_t word = load_uint32_t(bytes) | uint64_t(load_uint32_t(bytes + length - 4)) << 32;
+        hash = (hash ^ word) * hash_multiplier;
+    }
+    else if (length > 0)
+    {
+        uint64_t word = bytes[0] | bytes[length / 2] << 8 | bytes[length - 1] << 16;
+        hash = (hash ^ word) * hash_multiplier;
+    }
+    return static_cast<uint32_t>(hash >> 32);
 }
 
+/**
+ * The longest instruction sequence that can be counted.
+ */
+constexpr unsigned max_sequence_length = 16;
+
 struct reader_t
 {
     uint8_t* code;
-    uint32_t code_length;
-    uint32_t ip;
-    uint32_t hash1;
-    uint32_t hash2;
+    offset_t code_length;
+    offset_t ip;
 
-    void check_code_has(size_t n, char const* what)
+    void check_code_has(uint64_t n, char const* what)
     {
-        if (ip + n > code_length)
+        if (n > code_length - ip)
         {
-            failure("Expected %s at offset %zu, got end of bytecode", what, ip);
+            failure(
+                "Expected %s at offset %zu, got end of bytecode", what, static_cast<size_t>(ip)
+            );
         }
     }
 
@@ -52,16 +109,16 @@ struct reader_t
         return value;
     }
 
+    void skip(uint64_t n, char const* what)
+    {
+        check_code_has(n, what);
+        ip += n;
+    }
+
     void read(uint8_t* buffer, size_t n, char const* what)
     {
         check_code_has(n, what);
-        for (size_t i = 0; i < n; ++i)
-        {
-            uint8_t byte = code[ip + i];
-            buffer[i] = byte;
-            update_hash(hash1, byte);
-            update_hash(hash2, byte);
-        }
+        memcpy(buffer, code + ip, n);
         ip += n;
     }
 };
@@ -72,15 +129,15 @@ enum class instruction_flow
      * Only the next instruction is directly reachable.
      *
      * This is the only flow that allows the current instruction
-     * to be considered as a beginning of a two-instruction sequence.
+     * to be continued by the next one in a sequence.
      */
     normal,
 
     /**
      * Both the next instruction and the target are directly reachable.
      *
-     * The current instruction is not considered
-     * as a beginning of a two-instruction sequence.
+     * The current instruction is not continued
+     * by the next one in a sequence.
      *
      * Note that this flow, despite its name,
      * is also intended to be used for conditional jumps.
@@ -89,8 +146,8 @@ enum class instruction_flow
 
     /**
      * The next instruction is not directly reachable.
-     * Naturally, the current instruction is not considered
-     * as a beginning of a two-instruction sequence.
+     * Naturally, the current instruction is not continued
+     * by the next one in a sequence.
      *
      * If the target is specified, it is considered directly reachable.
      * For example, this is intended to be used for unconditional jumps.
@@ -101,155 +158,1461 @@ enum class instruction_flow
 struct instruction_result
 {
     /**
-     * UINT32_MAX means "no target".
+     * `no_target` means "no target".
      */
-    uint32_t target;
+    offset_t target;
 
     instruction_flow flow;
 };
 
+/**
+ * With wide offsets, the packing keeps an entry at 20 bytes instead of 24.
+ * The lengths stay 32-bit: a single key longer than 4 GB is not supported.
+ */
+#pragma pack(push, 4)
+
 struct hashtable_key
 {
-    uint32_t ip;
+    offset_t ip;
     uint32_t length;
+
+    /**
+     * The `hash_bytes` of the key, so that growing and merging tables doesn't read the code,
+     * and probing reads it only for the keys with equal hashes.
+     */
+    uint32_t hash;
+
+#ifdef INLINE_KEYS
+    /**
+     * The first `inline_key_length` bytes of the key.
+     * Only the longer keys need to be compared through the code.
+     */
+    uint8_t bytes[16];
+#endif
 };
 
+#ifdef INLINE_KEYS
+constexpr uint32_t inline_key_length = sizeof(hashtable_key::bytes);
+#endif
+
 struct hashtable_entry
 {
     hashtable_key key;
     uint32_t value;
 
+    /**
+     * Entries with equal counts are ordered by their first occurrence,
+     * so that the output doesn't depend on the table layout.
+     */
     bool operator<(const hashtable_entry& other) const
     {
-        return value < other.value;
+        if (value != other.value)
+        {
+            return value < other.value;
+        }
+        if (key.ip != other.key.ip)
+        {
+            return key.ip < other.key.ip;
+        }
+        return key.length < other.key.length;
     }
 };
 
-struct hashtable
+#pragma pack(pop)
+
+/**
+ * The size a table starts at when nothing tells how many keys it gets.
+ */
+constexpr offset_t initial_hashtable_size = 1 << 16;
+
+/**
+ * The tables for a code range start with room for a key per this many bytes of it.
+ * The generated files have a key per 40 bytes with few distinct operands,
+ * and they grow the table once with repeated code (a key per 16 bytes)
+ * and four times without (a key per 3 bytes), which is cheap with the hashes stored.
+ */
+constexpr uint64_t code_bytes_per_key = 32;
+
+/**
+ * Adds `occurrences` to a 32-bit count, stopping at `UINT32_MAX` instead of wrapping.
+ * Returns false if the count has stopped there.
+ */
+inline bool add_saturating(uint32_t& count, uint32_t occurrences)
 {
-    uint32_t size;
-    std::unique_ptr<hashtable_entry[]> entries;
+    if (__builtin_add_overflow(count, occurrences, &count))
+    {
+        count = UINT32_MAX;
+        return false;
+    }
+    return true;
+}
 
-    hashtable(uint32_t size);
+/**
+ * The smallest size at which the `3/4` load factor still leaves a free slot
+ * for every probe to stop at.
+ */
+constexpr offset_t min_hashtable_size = 4;
 
-    void mark_occurrence(uint8_t* code_ptr, uint32_t hash, uint32_t ip, uint32_t length);
+/**
+ * A growing array gives its old entries back a huge page at a time as they are moved,
+ * and fills the new ones about in the same order, so while it grows,
+ * it takes at most this much more memory than its new size.
+ */
+constexpr size_t growth_overhead = 2 * huge_page_size;
 
-    uint32_t pack();
-};
+/**
+ * The most entries of `entry_size` bytes that fit into `memory_limit` bytes
+ * with the `growth_overhead` of each of the `arrays` that make them up.
+ */
+inline uint64_t growable_entries(size_t memory_limit, size_t entry_size, unsigned arrays = 1)
+{
+    size_t overhead = growth_overhead * arrays;
+    return memory_limit > overhead ? (memory_limit - overhead) / entry_size : 0;
+}
 
-template <typename Handler>
-struct analyzer
+/**
+ * Scales a 32-bit mixed hash to [0, size).
+ * This is monotonic in the mixed hash.
+ */
+inline offset_t scale_hash(uint64_t mixed_hash, uint64_t size)
 {
-    uint8_t* code_ptr;
-    uint32_t code_size;
-    hashtable table;
-    std::vector<bool> visited;
-    std::vector<bool> is_flow_continued;
+    return mixed_hash * (size >> 32) + ((mixed_hash * (size & UINT32_MAX)) >> 32);
+}
+
+/**
+ * Keys of at most this many bytes are counted in an array indexed by their bytes.
+ */
+constexpr uint32_t short_key_length = 2;
+constexpr uint32_t short_entries_count = 256 + 65536;
+
+/**
+ * The table starts small and doubles whenever it becomes 3/4 full,
+ * up to `max_size` entries.
+ */
+struct hashtable
+{
+    offset_t size;
+    offset_t max_size;
+
+    /**
+     * The number of stored keys.
+     */
+    offset_t used = 0;
+
+    mapped_array<hashtable_entry> entries;
+
+    /**
+     * The short keys are kept off the probing path until `fold_short_keys`.
+     */
+    mapped_array<hashtable_entry> short_entries;
+
+    /**
+     * The number of times the table has been rehashed into a larger one.
+     */
+    uint64_t grows = 0;
+
+    /**
+     * Whether some count of `add_occurrences` has stopped at `UINT32_MAX`,
+     * which only the totals of a large corpus reach.
+     */
+    bool is_saturated = false;
+
+    /**
+     * Whether the keys have been moved out of their slots by `pack` or `pack_pair_counts`.
+     * A packed table is only read in order: adding keys to it or merging into it fails.
+     */
+    bool is_packed = false;
+
+    probe_stats stats;
+
+    hashtable(offset_t size, offset_t max_size);
 
-    analyzer(uint8_t* code_ptr, uint32_t code_size, uint32_t max_entries)
-        : code_ptr(code_ptr), code_size(code_size), table(max_entries / 3 * 4),
-          visited(code_size, false), is_flow_continued(code_size, true)
+    offset_t home_index(uint32_t hash) const
     {
+        return slot_of(static_cast<uint32_t>(hash * mixing_constant));
     }
 
-    void find_reachable(uint32_t initial_ip)
+    offset_t slot_of(uint64_t mixed_hash) const
     {
-        std::vector worklist{initial_ip};
+        return scale_hash(mixed_hash, size);
+    }
 
-        while (!worklist.empty())
-        {
-            uint32_t ip = worklist.back();
-            worklist.pop_back();
-            bool continue_flow = false;
-            is_flow_continued[ip] = false;
+    static uint32_t short_index(uint8_t const* bytes, uint32_t length)
+    {
+        return length == 1 ? bytes[0] : 256 + (bytes[0] | bytes[1] << 8);
+    }
 
-            while (ip < code_size)
+    void mark_occurrence(uint8_t* code_ptr, uint32_t hash, offset_t ip, uint32_t length)
+    {
+        if (length <= short_key_length)
+        {
+            hashtable_entry& entry = short_entries[short_index(code_ptr + ip, length)];
+            if (entry.value++ == 0)
             {
-                if (visited[ip])
-                {
-                    break;
-                }
-                visited[ip] = true;
-                is_flow_continued[ip] = is_flow_continued[ip] && continue_flow;
-                continue_flow = false;
+                entry.key.ip = ip;
+                entry.key.length = length;
+            }
+            return;
+        }
+        add_occurrences(code_ptr, hash, ip, length, 1);
+    }
 
-                reader_t reader = make_reader(ip);
-                instruction_result result = Handler().describe_flow(reader);
-                Handler().print(reader, nullptr);
-                ip = reader.ip;
+    /**
+     * Hashes only the keys that go into the table.
+     */
+    void mark_occurrence(uint8_t* code_ptr, offset_t ip, uint32_t length)
+    {
+        uint32_t hash = length <= short_key_length ? 0 : hash_bytes(code_ptr + ip, length);
+        mark_occurrence(code_ptr, hash, ip, length);
+    }
 
-                if (result.target != UINT32_MAX)
-                {
-                    worklist.push_back(result.target);
-                }
-                if (result.flow == instruction_flow::normal)
-                {
-                    continue_flow = true;
-                }
-                if (result.flow == instruction_flow::call)
-                {
-                    worklist.push_back(ip);
-                }
-                if (result.flow == instruction_flow::stop)
-                {
-                    break;
-                }
-            }
+    void add_occurrences(
+        uint8_t* code_ptr, uint32_t hash, offset_t ip, uint32_t length, uint32_t occurrences
+    );
+
+    /**
+     * Hashes only the keys that go into the table, like `mark_occurrence`.
+     */
+    void add_occurrences(uint8_t* code_ptr, offset_t ip, uint32_t length, uint32_t occurrences);
+
+    /**
+     * Grows the table so that it can hold `keys` keys without growing.
+     * Returns false if `max_size` doesn't allow that.
+     */
+    bool reserve(offset_t keys);
+
+    /**
+     * Moves the short keys into `entries`.
+     */
+    void fold_short_keys(uint8_t* code_ptr);
+
+    /**
+     * Moves all keys to the beginning of `entries`, in the order of their slots,
+     * and returns their number. The table is packed from then on.
+     */
+    offset_t pack(unsigned threads = 1);
+
+    /**
+     * Fails if the keys are no longer in their slots.
+     */
+    void check_unpacked() const
+    {
+        if (is_packed)
+        {
+            failure("Keys can't be added to a packed hashtable");
         }
     }
 
-    void count_occurrences()
+  private:
+    void resize(offset_t new_size);
+};
+
+/**
+ * The distinct instructions of a code range, numbered densely in the order
+ * of their first occurrence. The short ones are found by their bytes like
+ * in `hashtable`, the other ones through slots holding their hashes and IDs,
+ * so that probing reads the code only when the hashes are equal.
+ */
+struct instruction_ids
+{
+    struct instruction
+    {
+        offset_t ip;
+        uint32_t length;
+        uint32_t count;
+    };
+
+    struct slot
+    {
+        uint32_t hash;
+
+        /**
+         * The ID plus one, zero in the free slots.
+         */
+        uint32_t id;
+    };
+
+    offset_t size;
+    offset_t max_size;
+    mapped_array<slot> slots;
+
+    /**
+     * The IDs of the short instructions plus one, indexed by `hashtable::short_index`.
+     */
+    mapped_array<uint32_t> short_ids;
+
+    /**
+     * The instructions by their IDs, with room for as many as the slots.
+     */
+    mapped_array<instruction> instructions;
+
+    uint32_t count = 0;
+
+    instruction_ids(offset_t size, offset_t max_size);
+
+    /**
+     * Counts the instruction at `ip` and returns its ID.
+     */
+    uint32_t mark_occurrence(uint8_t* code_ptr, offset_t ip, uint32_t length)
     {
-        reader_t reader = make_reader(0);
-        uint32_t current_ip = 0;
-        reader.hash1 = hash_initial;
-        for (; reader.ip < code_size;)
+        if (length <= short_key_length)
         {
-            if (!visited[reader.ip])
+            uint32_t& short_id = short_ids[hashtable::short_index(code_ptr + ip, length)];
+            if (short_id == 0)
+            {
+                short_id = add(ip, length) + 1;
+            }
+            else
+            {
+                ++instructions[short_id - 1].count;
+            }
+            return short_id - 1;
+        }
+
+        uint32_t hash = hash_bytes(code_ptr + ip, length);
+        offset_t index = home_index(hash);
+        for (; slots[index].id != 0; index = (index + 1) % size)
+        {
+            if (slots[index].hash != hash)
             {
-                ++reader.ip;
                 continue;
             }
+            instruction& known = instructions[slots[index].id - 1];
+            if (known.length == length &&
+                memcmp(code_ptr + known.ip, code_ptr + ip, length) == 0)
+            {
+                ++known.count;
+                return slots[index].id - 1;
+            }
+        }
+
+        offset_t old_size = size;
+        uint32_t id = add(ip, length);
+        if (size != old_size)
+        {
+            index = free_index(hash);
+        }
+        slots[index] = {hash, id + 1};
+        return id;
+    }
+
+  private:
+    offset_t home_index(uint32_t hash) const
+    {
+        return scale_hash(static_cast<uint32_t>(hash * mixing_constant), size);
+    }
+
+    offset_t free_index(uint32_t hash) const;
+
+    uint32_t add(offset_t ip, uint32_t length);
+
+    void resize(offset_t new_size);
+};
+
+#pragma pack(push, 4)
+
+struct pair_entry
+{
+    /**
+     * The ID of the first instruction in the high half and the one of the second
+     * in the low half.
+     */
+    uint64_t ids;
+
+    /**
+     * The first occurrence of the pair.
+     */
+    offset_t ip;
+
+    uint32_t value;
+};
+
+#pragma pack(pop)
+
+/**
+ * Counts of the pairs of instructions keyed by their `instruction_ids`,
+ * so that a probe compares a single integer instead of the bytes of the pair.
+ * Grows like `hashtable`.
+ */
+struct pair_table
+{
+    offset_t size;
+    offset_t max_size;
+    offset_t used = 0;
+    mapped_array<pair_entry> entries;
 
-            uint32_t prev_ip = current_ip;
-            current_ip = reader.ip;
-            reader.hash2 = reader.hash1;
-            reader.hash1 = hash_initial;
+    pair_table(offset_t size, offset_t max_size);
 
-            Handler().print(reader, nullptr);
+    offset_t home_index(uint64_t ids) const
+    {
+        return scale_hash((ids * hash_multiplier) >> 32, size);
+    }
 
-            table.mark_occurrence(code_ptr, reader.hash1, current_ip, reader.ip - current_ip);
-            if (is_flow_continued[current_ip])
+    void mark_occurrence(uint32_t first, uint32_t second, offset_t ip)
+    {
+        uint64_t ids = static_cast<uint64_t>(first) << 32 | second;
+        offset_t index = home_index(ids);
+        for (; entries[index].value != 0; index = (index + 1) % size)
+        {
+            if (entries[index].ids == ids)
             {
-                table.mark_occurrence(code_ptr, reader.hash2, prev_ip, reader.ip - prev_ip);
+                ++entries[index].value;
+                return;
             }
         }
+        add(index, ids, ip);
     }
 
-    void print_hashtable(uint32_t threshold)
+  private:
+    void add(offset_t free_index, uint64_t ids, offset_t ip);
+
+    void resize(offset_t new_size);
+};
+
+/**
+ * Adds the counted instructions and pairs to `table` as keys of bytes.
+ */
+void add_pair_counts(
+    hashtable& table, uint8_t* code_ptr, instruction_ids const& ids, pair_table const& pairs
+);
+
+/**
+ * Puts the counted instructions and pairs into the empty `table` as keys of bytes,
+ * already packed in the order of their IDs, so the table is packed from then on.
+ */
+void pack_pair_counts(hashtable& table, instruction_ids const& ids, pair_table const& pairs);
+
+/**
+ * Adds the counts of all `sources` into `destination` using `threads` threads.
+ *
+ * The sources are expected to be counted over consecutive code ranges
+ * and passed in the order of these ranges, so that every key
+ * keeps the offset of its first occurrence.
+ */
+void merge_hashtables(
+    hashtable& destination, std::vector<hashtable> const& sources, uint8_t* code_ptr,
+    unsigned threads
+);
+
+/**
+ * Sorts the entries in the order of `hashtable_entry::operator<` using `threads` threads.
+ */
+void sort_entries(hashtable_entry* begin, hashtable_entry* end, unsigned threads = 1);
+
+/**
+ * Counts of the opcode sequences of up to `max_length` opcodes, ignoring the operands.
+ * The sequences of every length have their own dense array,
+ * indexed by the dense opcode indices of the sequence as digits
+ * in base `opcode_count`, the first opcode being the most significant.
+ */
+struct opcode_counts
+{
+    unsigned opcode_count;
+    unsigned max_length;
+
+    /**
+     * `offsets[length]` is where the array for `length` starts in `counts`.
+     */
+    uint64_t offsets[max_sequence_length + 2];
+    mapped_array<uint32_t> counts;
+
+    /**
+     * Whether some count of `add` has stopped at `UINT32_MAX`.
+     */
+    bool is_saturated = false;
+
+    opcode_counts(unsigned opcode_count, unsigned max_length);
+
+    /**
+     * The number of counters for the given alphabet and length, or `UINT64_MAX`
+     * if it doesn't even fit into 64 bits.
+     */
+    static uint64_t size(unsigned opcode_count, unsigned max_length);
+
+    uint32_t* of_length(unsigned length)
+    {
+        return counts.get() + offsets[length];
+    }
+
+    uint32_t const* of_length(unsigned length) const
+    {
+        return counts.get() + offsets[length];
+    }
+
+    void add(opcode_counts const& other);
+};
+
+struct atomic_bitset
+{
+    mapped_array<std::atomic<uint64_t>> words;
+
+    atomic_bitset(size_t size);
+
+    bool test(size_t i) const
+    {
+        return (words[i / 64].load(std::memory_order_relaxed) >> (i % 64)) & 1;
+    }
+
+    /**
+     * Must not race with modifications of the same word by other threads.
+     */
+    void set(size_t i)
     {
-        uint32_t packed_size = table.pack();
-        std::sort(table.entries.get(), table.entries.get() + packed_size);
+        std::atomic<uint64_t>& word = words[i / 64];
+        word.store(word.load(std::memory_order_relaxed) | bit(i), std::memory_order_relaxed);
+    }
 
-        uint32_t i;
-        for (i = 0; i < packed_size && table.entries[i].value < threshold; ++i)
-            ;
-        for (; i < packed_size; ++i)
+    /**
+     * Returns the first set bit in [from, limit), or `limit` if there is none.
+     * Skips 64 clear bits at a time.
+     */
+    size_t find_next(size_t from, size_t limit) const
+    {
+        if (from >= limit)
         {
-            hashtable_entry& entry = table.entries[i];
-            reader_t reader = make_reader(entry.key.ip);
-            printf("%u x", entry.value);
-            while (reader.ip < entry.key.ip + entry.key.length)
+            return limit;
+        }
+        size_t index = from / 64;
+        uint64_t word = words[index].load(std::memory_order_relaxed) & (~uint64_t(0) << (from % 64));
+        while (word == 0)
+        {
+            if (++index * 64 >= limit)
+            {
+                return limit;
+            }
+            word = words[index].load(std::memory_order_relaxed);
+        }
+        return std::min(limit, index * 64 + __builtin_ctzll(word));
+    }
+
+    /**
+     * The number of set bits in [0, size).
+     */
+    size_t count(size_t size) const
+    {
+        size_t count = 0;
+        for (size_t index = 0; index * 64 < size; ++index)
+        {
+            uint64_t word = words[index].load(std::memory_order_relaxed);
+            if ((index + 1) * 64 > size)
             {
-                printf(" ");
-                Handler().print(reader, stdout);
+                word &= ~(~uint64_t(0) << (size % 64));
             }
-            printf("\n");
+            count += __builtin_popcountll(word);
         }
+        return count;
+    }
+
+    /**
+     * Sets the bit atomically.
+     * Returns true if it has been set by this call.
+     */
+    bool claim(size_t i)
+    {
+        return !(words[i / 64].fetch_or(bit(i), std::memory_order_relaxed) & bit(i));
     }
 
   private:
-    reader_t make_reader(uint32_t ip)
+    static uint64_t bit(size_t i)
+    {
+        return uint64_t(1) << (i % 64);
+    }
+};
+
+/**
+ * A worklist of a single reachability thread.
+ * The owner works on its back, while other threads steal from its front.
+ */
+struct work_deque
+{
+    std::mutex mutex;
+    std::deque<offset_t> items;
+
+    void push(offset_t ip);
+
+    bool pop(offset_t& ip);
+
+    bool steal(offset_t& ip);
+};
+
+/**
+ * Prints the entries in [begin, end) in this order.
+ * `Entry` has the `key` and the `value` of a `hashtable_entry`,
+ * and the keys are decoded from `code_ptr`.
+ */
+template <typename Handler, typename Entry>
+void print_entry_range(
+    Entry const* begin, Entry const* end, uint8_t* code_ptr, offset_t code_size,
+    report_writer& output, char const* name = nullptr
+)
+{
+    output.begin_report(name, end - begin);
+    for (Entry const* it = begin; it != end; ++it)
+    {
+        Entry const& entry = *it;
+        output.begin_entry(entry.value);
+        if (output.wants_key_bytes())
+        {
+            output.key_bytes(code_ptr + entry.key.ip, entry.key.length);
+        }
+        else
+        {
+            reader_t reader;
+            reader.code = code_ptr;
+            reader.code_length = code_size;
+            reader.ip = entry.key.ip;
+            while (reader.ip < entry.key.ip + entry.key.length)
+            {
+                output.begin_instruction();
+                Handler().print(reader, output);
+            }
+        }
+        output.end_entry();
+    }
+    output.end_report();
+}
+
+/**
+ * Prints at most `top` most frequent of the packed entries in [begin, end)
+ * that occur at least `threshold` times. Only the printed entries are sorted.
+ * The keys are decoded from `code_ptr`.
+ */
+template <typename Handler>
+void print_entries(
+    hashtable_entry* begin, hashtable_entry* end, uint8_t* code_ptr, offset_t code_size,
+    report_writer& output, uint32_t threshold, offset_t top = no_limit,
+    char const* name = nullptr, unsigned threads = 1
+)
+{
+    hashtable_entry* printed_begin = begin;
+    hashtable_entry* printed_end = std::partition(
+        begin, end, [threshold](hashtable_entry const& entry) { return entry.value >= threshold; }
+    );
+    if (static_cast<offset_t>(printed_end - printed_begin) > top)
+    {
+        printed_begin = printed_end - top;
+        std::nth_element(begin, printed_begin, printed_end);
+    }
+    sort_entries(printed_begin, printed_end, threads);
+
+    print_entry_range<Handler>(printed_begin, printed_end, code_ptr, code_size, output, name);
+}
+
+/**
+ * The first of the entries that `print_entries` would print,
+ * if [begin, end) is already sorted, so that the printed ones are at its end.
+ */
+template <typename Entry>
+Entry const* first_printed_entry(
+    Entry const* begin, Entry const* end, uint32_t threshold, offset_t top = no_limit
+)
+{
+    Entry const* printed_begin = std::partition_point(
+        begin, end, [threshold](Entry const& entry) { return entry.value < threshold; }
+    );
+    if (static_cast<uint64_t>(end - printed_begin) > top)
+    {
+        printed_begin = end - top;
+    }
+    return printed_begin;
+}
+
+/**
+ * Prints the opcode sequences the same way as `print_entries` prints the keys.
+ * Sequences with equal counts are ordered by their length and then by their opcodes.
+ */
+template <typename Handler>
+void print_opcode_counts(
+    opcode_counts const& counts, report_writer& output, uint32_t threshold,
+    offset_t top = no_limit, char const* name = nullptr
+)
+{
+    struct printed_sequence
+    {
+        uint32_t count;
+        unsigned length;
+        uint64_t index;
+
+        bool operator<(printed_sequence const& other) const
+        {
+            return std::tie(count, length, index) <
+                   std::tie(other.count, other.length, other.index);
+        }
+    };
+
+    std::vector<printed_sequence> printed;
+    for (unsigned length = 1; length <= counts.max_length; ++length)
+    {
+        uint32_t const* of_length = counts.of_length(length);
+        uint64_t size = counts.offsets[length + 1] - counts.offsets[length];
+        for (uint64_t index = 0; index < size; ++index)
+        {
+            if (of_length[index] != 0 && of_length[index] >= threshold)
+            {
+                printed.push_back({of_length[index], length, index});
+            }
+        }
+    }
+    auto printed_begin = printed.begin();
+    if (printed.size() > top)
+    {
+        printed_begin = printed.end() - top;
+        std::nth_element(printed.begin(), printed_begin, printed.end());
+    }
+    std::sort(printed_begin, printed.end());
+
+    output.begin_report(name, printed.end() - printed_begin);
+    for (auto it = printed_begin; it != printed.end(); ++it)
+    {
+        uint8_t opcodes[max_sequence_length];
+        uint64_t index = it->index;
+        for (unsigned i = it->length; i-- > 0;)
+        {
+            opcodes[i] = Handler::opcode_byte(index % counts.opcode_count);
+            index /= counts.opcode_count;
+        }
+
+        output.begin_entry(it->count);
+        if (output.wants_key_bytes())
+        {
+            output.key_bytes(opcodes, it->length);
+        }
+        else
+        {
+            for (unsigned i = 0; i < it->length; ++i)
+            {
+                output.begin_instruction();
+                output.mnemonic(Handler::mnemonic(opcodes[i]));
+            }
+        }
+        output.end_entry();
+    }
+    output.end_report();
+}
+
+template <typename Handler>
+struct analyzer
+{
+    uint8_t* code_ptr;
+    offset_t code_size;
+    size_t memory_limit;
+
+    /**
+     * Sequences of up to this many instructions are counted.
+     */
+    unsigned max_length;
+
+    hashtable table;
+    atomic_bitset visited;
+
+    /**
+     * Instructions that can't continue a sequence.
+     */
+    atomic_bitset flow_breaks;
+
+    /**
+     * The bytes of the reachable instructions, counted only with `COLLECT_STATS`.
+     */
+    uint64_t decoded_bytes = 0;
+
+    /**
+     * `memory_limit` bounds the size of the hashtable in bytes.
+     * With multiple threads, the per-range hashtables share another such budget.
+     * `max_length` is at most `max_sequence_length`.
+     */
+    analyzer(
+        uint8_t* code_ptr, offset_t code_size, size_t memory_limit = SIZE_MAX,
+        unsigned max_length = 2
+    )
+        : code_ptr(code_ptr), code_size(code_size), memory_limit(memory_limit),
+          max_length(max_length), table(make_table(code_size, memory_limit, max_length)),
+          visited(code_size), flow_breaks(code_size)
+    {
+    }
+
+    /**
+     * Takes the page faults of the bitsets and the table with `threads` threads,
+     * instead of one by one as the exploration reaches them.
+     */
+    void prefault_memory(unsigned threads)
+    {
+        size_t bitset_bytes = (code_size + size_t(63)) / 64 * sizeof(uint64_t);
+        prefault(visited.words.get(), bitset_bytes, threads);
+        prefault(flow_breaks.words.get(), bitset_bytes, threads);
+        prefault(table.entries.get(), table.size * sizeof(hashtable_entry), threads);
+    }
+
+    /**
+     * The resulting `visited` and `flow_breaks` don't depend
+     * on the order of the exploration, so they are the same
+     * for any number of threads.
+     */
+    void find_reachable(std::vector<offset_t> const& initial_ips, unsigned threads = 1)
+    {
+        if (threads <= 1)
+        {
+            find_reachable_serial(initial_ips);
+            return;
+        }
+
+        std::vector<work_deque> deques(threads);
+        for (size_t i = 0; i < initial_ips.size(); ++i)
+        {
+            deques[i % threads].push(initial_ips[i]);
+        }
+
+        std::atomic<size_t> pending = initial_ips.size();
+        std::vector<uint64_t> worker_decoded_bytes(threads, 0);
+        std::vector<std::thread> workers;
+        for (unsigned i = 0; i < threads; ++i)
+        {
+            workers.emplace_back(
+                [this, &deques, &pending, &worker_decoded_bytes, i, threads]()
+                {
+                    uint64_t decoded = 0;
+                    while (true)
+                    {
+                        offset_t ip;
+                        bool found = deques[i].pop(ip);
+                        for (unsigned j = 1; !found && j < threads; ++j)
+                        {
+                            found = deques[(i + j) % threads].steal(ip);
+                        }
+
+                        if (found)
+                        {
+                            explore_concurrently(ip, deques[i], pending, decoded);
+                            pending.fetch_sub(1, std::memory_order_release);
+                        }
+                        else if (pending.load(std::memory_order_acquire) == 0)
+                        {
+                            break;
+                        }
+                        else
+                        {
+                            std::this_thread::yield();
+                        }
+                    }
+                    worker_decoded_bytes[i] = decoded;
+                }
+            );
+        }
+        for (std::thread& worker : workers)
+        {
+            worker.join();
+        }
+        for (uint64_t decoded : worker_decoded_bytes)
+        {
+            decoded_bytes += decoded;
+        }
+    }
+
+    void count_occurrences(unsigned threads = 1)
+    {
+        count_ranges(
+            threads, memory_limit,
+            [this](hashtable& range_table, offset_t begin, offset_t end, size_t)
+            { count_range(range_table, begin, end); }
+        );
+    }
+
+    /**
+     * Same as `count_occurrences` for `max_length` of at most 2, but counts the pairs
+     * by the IDs of their instructions. They become keys of bytes only once per key:
+     * with a single thread, the table is left packed without hashing them at all,
+     * otherwise they are added to the tables of the ranges before these are merged.
+     *
+     * The IDs, the pairs and the table each get a third of `memory_limit`,
+     * and with multiple threads the ranges split another such budget the same way.
+     */
+    void count_pairs(unsigned threads = 1)
+    {
+        if (max_length > 2)
+        {
+            failure("Pairs of instruction IDs are only counted for --max-length up to 2");
+        }
+        size_t share = memory_limit / 3;
+        table = make_table(code_size, share, max_length);
+        if (threads <= 1)
+        {
+            instruction_ids ids = make_instruction_ids(code_size, share);
+            pair_table pairs = make_pair_table(code_size, share);
+            count_pair_range(ids, pairs, 0, code_size);
+            pack_pair_counts(table, ids, pairs);
+            return;
+        }
+
+        count_ranges(
+            threads, share,
+            [this](hashtable& range_table, offset_t begin, offset_t end, size_t range_limit)
+            {
+                instruction_ids ids = make_instruction_ids(end - begin, range_limit);
+                pair_table pairs = make_pair_table(end - begin, range_limit);
+                offset_t open_start = count_pair_range(ids, pairs, begin, end);
+                add_pair_counts(range_table, code_ptr, ids, pairs);
+                count_continued_pair(range_table, open_start, end);
+            }
+        );
+    }
+
+    /**
+     * Counts the opcode sequences instead of the exact ones, without any hashing.
+     * Every thread counts its own range into its own arrays, which are summed afterwards.
+     */
+    opcode_counts count_opcodes(unsigned threads = 1)
+    {
+        uint64_t size = opcode_counts::size(Handler::opcode_count, max_length);
+        if (size == UINT64_MAX || size > memory_limit / sizeof(uint32_t) / std::max(threads, 1u))
+        {
+            failure("The opcode counters for --max-length %u don't fit into the memory limit",
+                    max_length);
+        }
+
+        opcode_counts counts(Handler::opcode_count, max_length);
+        if (threads <= 1)
+        {
+            count_opcode_range(counts, 0, code_size);
+            return counts;
+        }
+
+        std::vector<offset_t> bounds = range_bounds(threads);
+        std::vector<opcode_counts> range_counts;
+        range_counts.reserve(threads - 1);
+        for (unsigned i = 1; i < threads; ++i)
+        {
+            range_counts.emplace_back(Handler::opcode_count, max_length);
+        }
+
+        std::vector<std::thread> workers;
+        for (unsigned i = 1; i < threads; ++i)
+        {
+            workers.emplace_back(
+                [this, &range_counts, &bounds, i]()
+                { count_opcode_range(range_counts[i - 1], bounds[i], bounds[i + 1]); }
+            );
+        }
+        count_opcode_range(counts, bounds[0], bounds[1]);
+        for (std::thread& worker : workers)
+        {
+            worker.join();
+        }
+
+        for (opcode_counts const& other : range_counts)
+        {
+            counts.add(other);
+        }
+        return counts;
+    }
+
+    /**
+     * Moves all keys to the beginning of `table.entries` and returns their number.
+     */
+    offset_t pack_table(unsigned threads = 1)
+    {
+        table.fold_short_keys(code_ptr);
+        return table.pack(threads);
+    }
+
+    void print_hashtable(
+        report_writer& output, uint32_t threshold, offset_t top = no_limit,
+        char const* name = nullptr, unsigned threads = 1
+    )
+    {
+        offset_t packed_size = pack_table(threads);
+        hashtable_entry* entries = table.entries.get();
+        print_entries<Handler>(
+            entries, entries + packed_size, code_ptr, code_size, output, threshold, top, name,
+            threads
+        );
+    }
+
+  private:
+    /**
+     * Runs `count(range_table, begin, end, range_memory_limit)` over the code
+     * with `threads` threads, each counting its own range into its own table,
+     * and merges the tables. The ranges share `range_budget` bytes for every
+     * structure they count into, the tables included.
+     */
+    template <typename Count>
+    void count_ranges(unsigned threads, size_t range_budget, Count const& count)
+    {
+        if (threads <= 1)
+        {
+            count(table, 0, code_size, range_budget);
+            return;
+        }
+
+        std::vector<offset_t> bounds = range_bounds(threads);
+        std::vector<hashtable> tables;
+        tables.reserve(threads);
+        for (unsigned i = 0; i < threads; ++i)
+        {
+            tables.push_back(
+                make_table(bounds[i + 1] - bounds[i], range_budget / threads, max_length)
+            );
+        }
+
+        std::vector<std::thread> workers;
+        for (unsigned i = 0; i < threads; ++i)
+        {
+            workers.emplace_back(
+                [&tables, &bounds, &count, i, threads, range_budget]()
+                { count(tables[i], bounds[i], bounds[i + 1], range_budget / threads); }
+            );
+        }
+        for (std::thread& worker : workers)
+        {
+            worker.join();
+        }
+
+        merge_hashtables(table, tables, code_ptr, threads);
+    }
+
+    /**
+     * The table never needs more entries than the worst case
+     * for the given code length.
+     */
+    static hashtable make_table(offset_t code_length, size_t memory_limit, unsigned max_length)
+    {
+        uint64_t max_size = Handler::max_entries(code_length, max_length) / 3 * 4;
+        max_size = std::min(max_size, growable_entries(memory_limit, sizeof(hashtable_entry)));
+        max_size = std::min<uint64_t>(max_size, std::numeric_limits<offset_t>::max());
+        return hashtable(initial_table_size(code_length, max_size), max_size);
+    }
+
+    /**
+     * Room for the keys estimated from the code length at the `3/4` load factor,
+     * within [`min_hashtable_size`, `max_size`].
+     */
+    static offset_t initial_table_size(offset_t code_length, uint64_t max_size)
+    {
+        uint64_t keys = code_length / code_bytes_per_key;
+        return static_cast<offset_t>(std::clamp<uint64_t>(
+            keys + keys / 3, min_hashtable_size, std::max<uint64_t>(max_size, min_hashtable_size)
+        ));
+    }
+
+    /**
+     * Same bounds as the ones of `make_table`, for the entries of another size
+     * that make up `arrays` arrays.
+     * The size is at least `min_hashtable_size`, so that probing always stops.
+     */
+    static offset_t max_table_size(
+        offset_t code_length, size_t memory_limit, unsigned max_length, size_t entry_size,
+        unsigned arrays = 1
+    )
+    {
+        uint64_t max_size = Handler::max_entries(code_length, max_length) / 3 * 4;
+        max_size = std::min(max_size, growable_entries(memory_limit, entry_size, arrays));
+        max_size = std::min<uint64_t>(max_size, UINT32_MAX);
+        return static_cast<offset_t>(std::max<uint64_t>(max_size, min_hashtable_size));
+    }
+
+    static instruction_ids make_instruction_ids(offset_t code_length, size_t memory_limit)
+    {
+        offset_t max_size = max_table_size(
+            code_length, memory_limit, 1,
+            sizeof(instruction_ids::slot) + sizeof(instruction_ids::instruction), 2
+        );
+        return instruction_ids(initial_table_size(code_length, max_size), max_size);
+    }
+
+    static pair_table make_pair_table(offset_t code_length, size_t memory_limit)
+    {
+        offset_t max_size = max_table_size(code_length, memory_limit, 2, sizeof(pair_entry));
+        return pair_table(initial_table_size(code_length, max_size), max_size);
+    }
+
+    /**
+     * Splits the code into `threads` ranges starting at the instructions
+     * that the single-threaded sweep decodes.
+     *
+     * A reachable offset can lie inside another reachable instruction
+     * if the bytecode jumps into operands. The sweep steps over such an offset,
+     * so a bound there is moved to where the sweep of the range before it ends.
+     * The sweeps are checked in parallel, and only a moved range is swept again.
+     */
+    std::vector<offset_t> range_bounds(unsigned threads)
+    {
+        std::vector<offset_t> bounds(threads + 1, code_size);
+        for (unsigned i = 0; i < threads; ++i)
+        {
+            offset_t ip = static_cast<offset_t>(static_cast<uint64_t>(code_size) * i / threads);
+            bounds[i] = visited.find_next(ip, code_size);
+        }
+
+        std::vector<offset_t> sweep_ends(threads);
+        std::vector<std::thread> workers;
+        for (unsigned i = 0; i < threads; ++i)
+        {
+            workers.emplace_back([this, &bounds, &sweep_ends, i]()
+                                 { sweep_ends[i] = sweep_end(bounds[i], bounds[i + 1]); });
+        }
+        for (std::thread& worker : workers)
+        {
+            worker.join();
+        }
+
+        for (unsigned i = 1; i < threads; ++i)
+        {
+            if (sweep_ends[i - 1] == bounds[i])
+            {
+                continue;
+            }
+            bounds[i] = sweep_ends[i - 1];
+            for (unsigned j = i + 1; j < threads && bounds[j] < bounds[i]; ++j)
+            {
+                bounds[j] = bounds[i];
+            }
+            sweep_ends[i] = sweep_end(bounds[i], bounds[i + 1]);
+        }
+        return bounds;
+    }
+
+    /**
+     * Decodes the reachable instructions starting in [begin, end) in the order
+     * of `count_range` and returns the offset where this sweep leaves the range.
+     */
+    offset_t sweep_end(offset_t begin, offset_t end)
+    {
+        reader_t reader = make_reader(begin);
+        while (reader.ip < end)
+        {
+            if (!visited.test(reader.ip))
+            {
+                reader.ip = visited.find_next(reader.ip, end);
+                continue;
+            }
+            Handler().decode(reader);
+        }
+        return std::max(reader.ip, end);
+    }
+
+    void find_reachable_serial(std::vector<offset_t> const& initial_ips)
+    {
+        std::vector<offset_t> worklist(initial_ips);
+
+        while (!worklist.empty())
+        {
+            offset_t ip = worklist.back();
+            worklist.pop_back();
+            bool continue_flow = false;
+            if (ip < code_size)
+            {
+                flow_breaks.set(ip);
+            }
+
+            while (ip < code_size)
+            {
+                if (visited.test(ip))
+                {
+                    break;
+                }
+                visited.set(ip);
+                if (!continue_flow)
+                {
+                    flow_breaks.set(ip);
+                }
+                continue_flow = false;
+
+                reader_t reader = make_reader(ip);
+                instruction_result result = Handler().decode(reader);
+                if (collect_stats)
+                {
+                    decoded_bytes += reader.ip - ip;
+                }
+                ip = reader.ip;
+
+                if (result.target != no_target)
+                {
+                    worklist.push_back(result.target);
+                }
+                if (result.flow == instruction_flow::normal)
+                {
+                    continue_flow = true;
+                }
+                if (result.flow == instruction_flow::call)
+                {
+                    worklist.push_back(ip);
+                }
+                if (result.flow == instruction_flow::stop)
+                {
+                    break;
+                }
+            }
+        }
+    }
+
+    /**
+     * Every instruction is decoded only by the thread that claims it.
+     *
+     * The flow breaks are exactly the offsets taken from the worklists.
+     * The offset after a call is not put on a worklist,
+     * since it is explored right away, so it is marked directly.
+     */
+    void explore_concurrently(
+        offset_t ip, work_deque& deque, std::atomic<size_t>& pending, uint64_t& decoded
+    )
+    {
+        if (ip < code_size)
+        {
+            flow_breaks.claim(ip);
+        }
+
+        while (ip < code_size)
+        {
+            if (visited.test(ip) || !visited.claim(ip))
+            {
+                break;
+            }
+
+            reader_t reader = make_reader(ip);
+            instruction_result result = Handler().decode(reader);
+            if (collect_stats)
+            {
+                decoded += reader.ip - ip;
+            }
+            ip = reader.ip;
+
+            if (result.target != no_target)
+            {
+                pending.fetch_add(1, std::memory_order_relaxed);
+                deque.push(result.target);
+            }
+            if (result.flow == instruction_flow::call && ip < code_size)
+            {
+                flow_breaks.claim(ip);
+            }
+            if (result.flow == instruction_flow::stop)
+            {
+                break;
+            }
+        }
+    }
+
+    /**
+     * The starts of the sequences that the next instruction can continue,
+     * from the newest (the previous instruction alone) to the oldest.
+     */
+    struct open_sequences
+    {
+        static constexpr unsigned capacity = max_sequence_length;
+
+        offset_t starts[capacity];
+        unsigned newest = 0;
+        unsigned count = 0;
+
+        unsigned slot(unsigned age) const
+        {
+            return (newest - age) % capacity;
+        }
+
+        void push(offset_t start)
+        {
+            newest = (newest + 1) % capacity;
+            starts[newest] = start;
+        }
+    };
+
+    /**
+     * Extends the `count` newest open sequences with the instruction ending at `end`
+     * and counts them. Every extended sequence is hashed as a whole,
+     * a word at a time, which is cheaper than carrying its hash byte by byte.
+     */
+    void
+    extend_sequences(hashtable& range_table, open_sequences& open, unsigned count, offset_t end)
+    {
+        for (unsigned age = 0; age < count; ++age)
+        {
+            offset_t start = open.starts[open.slot(age)];
+            range_table.mark_occurrence(code_ptr, start, end - start);
+        }
+    }
+
+    /**
+     * Counts the instructions starting in [begin, end)
+     * and the sequences of up to `max_length` instructions they begin.
+     *
+     * The sequences that continue past the first instruction of the range
+     * are left to the range before it, so `begin` is expected
+     * to be either zero or an instruction start.
+     */
+    void count_range(hashtable& range_table, offset_t begin, offset_t end)
+    {
+        reader_t reader = make_reader(begin);
+        open_sequences open;
+        for (; reader.ip < end;)
+        {
+            if (!visited.test(reader.ip))
+            {
+                reader.ip = visited.find_next(reader.ip, end);
+                open.count = 0;
+                continue;
+            }
+
+            offset_t current_ip = reader.ip;
+            if (flow_breaks.test(current_ip) || current_ip == begin)
+            {
+                open.count = 0;
+            }
+            Handler().decode(reader);
+
+            range_table.mark_occurrence(code_ptr, current_ip, reader.ip - current_ip);
+            extend_sequences(range_table, open, open.count, reader.ip);
+            open.push(current_ip);
+            open.count = std::min(open.count + 1, max_length - 1);
+        }
+
+        // The sequences still open at the end of the range are continued into the next one.
+        // After `extra` more instructions, only the ones of at most `max_length - extra`
+        // instructions can grow.
+        if (begin < end && reader.ip == end)
+        {
+            for (unsigned extra = 1; extra < max_length; ++extra)
+            {
+                unsigned count = std::min(open.count, max_length - extra);
+                offset_t current_ip = reader.ip;
+                if (count == 0 || current_ip >= code_size || !visited.test(current_ip) ||
+                    flow_breaks.test(current_ip))
+                {
+                    break;
+                }
+                Handler().decode(reader);
+                extend_sequences(range_table, open, count, reader.ip);
+            }
+        }
+    }
+
+    /**
+     * Same as `count_range` for `max_length` of at most 2, but counts the instructions
+     * into `ids` and the pairs into `pairs`. Every instruction is looked up by its bytes
+     * once, and every pair only by the IDs of its two instructions.
+     * Returns the start of the pair left open at `end`, or `end` if there is none.
+     */
+    offset_t
+    count_pair_range(instruction_ids& ids, pair_table& pairs, offset_t begin, offset_t end)
+    {
+        reader_t reader = make_reader(begin);
+        bool is_open = false;
+        uint32_t previous_id = 0;
+        offset_t previous_ip = 0;
+        for (; reader.ip < end;)
+        {
+            if (!visited.test(reader.ip))
+            {
+                reader.ip = visited.find_next(reader.ip, end);
+                is_open = false;
+                continue;
+            }
+
+            offset_t current_ip = reader.ip;
+            if (flow_breaks.test(current_ip) || current_ip == begin)
+            {
+                is_open = false;
+            }
+            Handler().decode(reader);
+
+            uint32_t id = ids.mark_occurrence(code_ptr, current_ip, reader.ip - current_ip);
+            if (is_open)
+            {
+                pairs.mark_occurrence(previous_id, id, previous_ip);
+            }
+            is_open = max_length == 2;
+            previous_id = id;
+            previous_ip = current_ip;
+        }
+
+        return is_open && reader.ip == end ? previous_ip : end;
+    }
+
+    /**
+     * Counts the pair starting at `start` that continues into the next range by its bytes,
+     * since its second instruction has an ID only in that range.
+     */
+    void count_continued_pair(hashtable& range_table, offset_t start, offset_t end)
+    {
+        if (start == end || end >= code_size || !visited.test(end) || flow_breaks.test(end))
+        {
+            return;
+        }
+        reader_t reader = make_reader(end);
+        Handler().decode(reader);
+        range_table.mark_occurrence(code_ptr, start, reader.ip - start);
+    }
+
+    /**
+     * Extends the open opcode sequences of lengths [low, high] with `opcode`
+     * and counts them. `open[length - 1]` is the index of the open sequence
+     * of that length, and becomes the index of the extended one.
+     */
+    void extend_opcode_sequences(
+        opcode_counts& counts, uint64_t* open, unsigned low, unsigned high, unsigned opcode
+    )
+    {
+        for (unsigned length = high; length >= low && length > 0; --length)
+        {
+            uint64_t index = open[length - 1] * counts.opcode_count + opcode;
+            counts.of_length(length + 1)[index]++;
+            open[length] = index;
+        }
+    }
+
+    /**
+     * Same as `count_range`, but for the opcode sequences.
+     */
+    void count_opcode_range(opcode_counts& counts, offset_t begin, offset_t end)
+    {
+        reader_t reader = make_reader(begin);
+        uint64_t open[max_sequence_length + 1];
+        unsigned open_length = 0;
+        uint32_t* singles = counts.of_length(1);
+        for (; reader.ip < end;)
+        {
+            if (!visited.test(reader.ip))
+            {
+                reader.ip = visited.find_next(reader.ip, end);
+                open_length = 0;
+                continue;
+            }
+
+            offset_t current_ip = reader.ip;
+            if (flow_breaks.test(current_ip) || current_ip == begin)
+            {
+                open_length = 0;
+            }
+            unsigned opcode = Handler::opcode_index(code_ptr + current_ip);
+            Handler().decode(reader);
+
+            singles[opcode]++;
+            extend_opcode_sequences(
+                counts, open, 1, std::min(open_length, max_length - 1), opcode
+            );
+            open[0] = opcode;
+            open_length = std::min(open_length + 1, max_length - 1);
+        }
+
+        // After `extra - 1` more opcodes, the open sequences that start
+        // before the end have from `extra` to `open_length + extra - 1` opcodes.
+        if (begin < end && reader.ip == end && open_length > 0)
+        {
+            for (unsigned extra = 1; extra < max_length; ++extra)
+            {
+                offset_t current_ip = reader.ip;
+                if (current_ip >= code_size || !visited.test(current_ip) ||
+                    flow_breaks.test(current_ip))
+                {
+                    break;
+                }
+                unsigned opcode = Handler::opcode_index(code_ptr + current_ip);
+                Handler().decode(reader);
+                extend_opcode_sequences(
+                    counts, open, extra, std::min(open_length + extra - 1, max_length - 1), opcode
+                );
+            }
+        }
+    }
+
+    reader_t make_reader(offset_t ip)
     {
         reader_t reader;
         reader.code = code_ptr;
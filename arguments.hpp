@@ -0,0 +1,36 @@
+#ifndef ARGUMENTS_HPP
+#define ARGUMENTS_HPP
+
+#include "assertions.hpp"
+
+#include <cstddef>
+#include <string>
+
+/**
+ * Parses a byte count with an optional K, M or G suffix.
+ */
+inline size_t parse_size(char const* text)
+{
+    size_t parsed;
+    size_t count = std::stoull(text, &parsed);
+    std::string suffix = text + parsed;
+    if (suffix == "K")
+    {
+        return count << 10;
+    }
+    if (suffix == "M")
+    {
+        return count << 20;
+    }
+    if (suffix == "G")
+    {
+        return count << 30;
+    }
+    if (!suffix.empty())
+    {
+        failure("Unknown size suffix: %s", text);
+    }
+    return count;
+}
+
+#endif
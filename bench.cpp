@@ -0,0 +1,391 @@
+#include "analyzer.hpp"
+#include "handler.hpp"
+#include "report.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+/**
+ * Benchmarks of the separate analysis components on synthetic code.
+ *
+ * Every input is generated from a fixed seed, so the numbers
+ * of two builds are comparable. Every benchmark is repeated
+ * and the best time is reported, together with the throughput
+ * in code bytes and in entries (keys, instructions or printed entries).
+ */
+
+constexpr unsigned repetitions = 3;
+constexpr unsigned bench_threads = 4;
+
+struct bench_result
+{
+    double seconds = std::numeric_limits<double>::max();
+    uint64_t bytes = 0;
+    uint64_t entries = 0;
+};
+
+struct stopwatch
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    double seconds() const
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+};
+
+static void report(char const* name, bench_result const& result)
+{
+    printf(
+        "%-36s %9.4f s %10.1f MB/s %10.2f M entries/s\n", name, result.seconds,
+        result.bytes / result.seconds / 1e6, result.entries / result.seconds / 1e6
+    );
+}
+
+struct code_builder
+{
+    std::vector<uint8_t> bytes;
+
+    void op(uint8_t opcode)
+    {
+        bytes.push_back(opcode);
+    }
+
+    void u32(uint32_t value)
+    {
+        for (int i = 0; i < 4; ++i)
+        {
+            bytes.push_back(static_cast<uint8_t>(value >> (8 * i)));
+        }
+    }
+
+    void put_u32(size_t at, uint32_t value)
+    {
+        for (int i = 0; i < 4; ++i)
+        {
+            bytes[at + i] = static_cast<uint8_t>(value >> (8 * i));
+        }
+    }
+};
+
+/**
+ * Straight-line code of simple instructions with operands in [0, operand_range).
+ * Only the first `reachable_fraction` of it is reachable, the rest follows an `END`.
+ */
+static std::vector<uint8_t>
+straight_line_code(size_t length, uint32_t operand_range, double reachable_fraction, uint64_t seed)
+{
+    std::mt19937_64 random(seed);
+    uint8_t const no_operands[] = {opcode_add, opcode_sub, opcode_drop, opcode_dup, opcode_elem};
+    uint8_t const one_operand[] = {opcode_const, opcode_ld_local, opcode_st_local, opcode_ld_arg};
+
+    code_builder code;
+    bool is_end_placed = false;
+    while (code.bytes.size() + 5 < length)
+    {
+        if (!is_end_placed && code.bytes.size() >= length * reachable_fraction)
+        {
+            code.op(opcode_end);
+            is_end_placed = true;
+        }
+        if (random() % 2 == 0)
+        {
+            code.op(no_operands[random() % sizeof(no_operands)]);
+        }
+        else
+        {
+            code.op(one_operand[random() % sizeof(one_operand)]);
+            code.u32(random() % operand_range);
+        }
+    }
+    code.op(opcode_end);
+    return code.bytes;
+}
+
+/**
+ * `JMP`s visiting every one of them in a random order, then an `END`.
+ */
+static std::vector<uint8_t> jump_chain_code(size_t jumps, uint64_t seed)
+{
+    std::mt19937_64 random(seed);
+    std::vector<uint32_t> order(jumps);
+    std::iota(order.begin(), order.end(), 0);
+    std::shuffle(order.begin() + 1, order.end(), random);
+
+    code_builder code;
+    code.bytes.resize(jumps * 5 + 1);
+    for (size_t i = 0; i < jumps; ++i)
+    {
+        size_t at = order[i] * size_t(5);
+        code.bytes[at] = opcode_jmp;
+        code.put_u32(at + 1, i + 1 < jumps ? order[i + 1] * 5 : jumps * 5);
+    }
+    code.bytes[jumps * 5] = opcode_end;
+    return code.bytes;
+}
+
+/**
+ * `CJMP_Z`s with random targets, so the worklists stay busy.
+ */
+static std::vector<uint8_t> branchy_code(size_t branches, uint64_t seed)
+{
+    std::mt19937_64 random(seed);
+    code_builder code;
+    for (size_t i = 0; i < branches; ++i)
+    {
+        code.op(opcode_cjmp_z);
+        code.u32(random() % branches * 5);
+    }
+    code.op(opcode_end);
+    return code.bytes;
+}
+
+static bench_result bench_hashtable_inserts(size_t keys, bool same_hash)
+{
+    std::mt19937_64 random(1);
+    std::vector<uint8_t> code(keys * 5 + 5);
+    for (uint8_t& byte : code)
+    {
+        byte = random();
+    }
+
+    bench_result result;
+    result.bytes = keys * 5;
+    result.entries = keys;
+    for (unsigned repetition = 0; repetition < repetitions; ++repetition)
+    {
+        // Sized so that the table ends up 3/4 full without growing.
+        offset_t size = keys / 3 * 4 + 8;
+        hashtable table(size, size);
+        stopwatch watch;
+        for (size_t i = 0; i < keys; ++i)
+        {
+            offset_t ip = i * 5;
+            uint32_t hash = same_hash ? 0 : hash_bytes(code.data() + ip, 5);
+            table.mark_occurrence(code.data(), hash, ip, 5);
+        }
+        result.seconds = std::min(result.seconds, watch.seconds());
+    }
+    return result;
+}
+
+static bench_result bench_hashtable_hits(size_t distinct_keys, size_t occurrences)
+{
+    std::mt19937_64 random(2);
+    std::vector<uint8_t> code(distinct_keys * 5 + 5);
+    for (uint8_t& byte : code)
+    {
+        byte = random();
+    }
+    std::vector<offset_t> ips(occurrences);
+    for (offset_t& ip : ips)
+    {
+        ip = random() % distinct_keys * 5;
+    }
+
+    bench_result result;
+    result.bytes = occurrences * 5;
+    result.entries = occurrences;
+    for (unsigned repetition = 0; repetition < repetitions; ++repetition)
+    {
+        hashtable table(initial_hashtable_size, std::numeric_limits<offset_t>::max());
+        stopwatch watch;
+        for (offset_t ip : ips)
+        {
+            table.mark_occurrence(code.data(), hash_bytes(code.data() + ip, 5), ip, 5);
+        }
+        result.seconds = std::min(result.seconds, watch.seconds());
+    }
+    return result;
+}
+
+static bench_result bench_pack(size_t keys, unsigned threads)
+{
+    std::mt19937_64 random(3);
+    std::vector<uint8_t> code(keys * 5 + 5);
+    for (uint8_t& byte : code)
+    {
+        byte = random();
+    }
+
+    bench_result result;
+    result.entries = keys;
+    for (unsigned repetition = 0; repetition < repetitions; ++repetition)
+    {
+        hashtable table(initial_hashtable_size, std::numeric_limits<offset_t>::max());
+        for (size_t i = 0; i < keys; ++i)
+        {
+            offset_t ip = i * 5;
+            table.mark_occurrence(code.data(), hash_bytes(code.data() + ip, 5), ip, 5);
+        }
+        result.bytes = uint64_t(table.size) * sizeof(hashtable_entry);
+        stopwatch watch;
+        table.pack(threads);
+        result.seconds = std::min(result.seconds, watch.seconds());
+    }
+    return result;
+}
+
+/**
+ * Mostly small counts, as in real tables, in the order of the slots.
+ */
+static bench_result bench_rank(size_t keys, unsigned threads, bool is_radix)
+{
+    std::mt19937_64 random(4);
+    std::geometric_distribution<uint32_t> counts(0.3);
+    std::vector<hashtable_entry> entries(keys);
+    for (hashtable_entry& entry : entries)
+    {
+        entry.key.ip = random();
+        entry.key.length = 5 + random() % 8;
+        entry.value = 1 + counts(random);
+    }
+
+    bench_result result;
+    result.entries = keys;
+    result.bytes = keys * sizeof(hashtable_entry);
+    for (unsigned repetition = 0; repetition < repetitions; ++repetition)
+    {
+        std::vector<hashtable_entry> sorted = entries;
+        stopwatch watch;
+        if (is_radix)
+        {
+            sort_entries(sorted.data(), sorted.data() + sorted.size(), threads);
+        }
+        else
+        {
+            std::sort(sorted.begin(), sorted.end());
+        }
+        result.seconds = std::min(result.seconds, watch.seconds());
+    }
+    return result;
+}
+
+static uint64_t reachable_instructions(analyzer<handler> const& analyzer)
+{
+    uint64_t instructions = 0;
+    for (offset_t ip = analyzer.visited.find_next(0, analyzer.code_size); ip < analyzer.code_size;
+         ip = analyzer.visited.find_next(ip + 1, analyzer.code_size))
+    {
+        ++instructions;
+    }
+    return instructions;
+}
+
+static bench_result bench_find_reachable(std::vector<uint8_t>& code, unsigned threads)
+{
+    bench_result result;
+    result.bytes = code.size();
+    for (unsigned repetition = 0; repetition < repetitions; ++repetition)
+    {
+        analyzer<handler> analyzer(code.data(), code.size());
+        stopwatch watch;
+        analyzer.find_reachable({0}, threads);
+        result.seconds = std::min(result.seconds, watch.seconds());
+        result.entries = reachable_instructions(analyzer);
+    }
+    return result;
+}
+
+static bench_result bench_count_occurrences(std::vector<uint8_t>& code, unsigned threads)
+{
+    bench_result result;
+    result.bytes = code.size();
+    for (unsigned repetition = 0; repetition < repetitions; ++repetition)
+    {
+        analyzer<handler> analyzer(code.data(), code.size());
+        analyzer.find_reachable({0});
+        stopwatch watch;
+        analyzer.count_occurrences(threads);
+        result.seconds = std::min(result.seconds, watch.seconds());
+        result.entries = reachable_instructions(analyzer);
+    }
+    return result;
+}
+
+static bench_result bench_print(std::vector<uint8_t>& code, output_format format)
+{
+    analyzer<handler> analyzer(code.data(), code.size());
+    analyzer.find_reachable({0});
+    analyzer.count_occurrences();
+    offset_t packed_size = analyzer.pack_table();
+    std::vector<hashtable_entry> entries(
+        analyzer.table.entries.get(), analyzer.table.entries.get() + packed_size
+    );
+
+    bench_result result;
+    result.entries = packed_size;
+    for (unsigned repetition = 0; repetition < repetitions; ++repetition)
+    {
+        std::vector<hashtable_entry> printed = entries;
+        FILE* file = tmpfile();
+        if (file == nullptr)
+        {
+            failure("Unable to create a temporary file");
+        }
+        stopwatch watch;
+        {
+            report_writer output(file, format);
+            print_entries<handler>(
+                printed.data(), printed.data() + printed.size(), code.data(), code.size(), output,
+                1
+            );
+        }
+        result.seconds = std::min(result.seconds, watch.seconds());
+        result.bytes = ftell(file);
+        fclose(file);
+    }
+    return result;
+}
+
+int main(int argc, char* argv[])
+{
+    size_t scale = 1;
+    for (int i = 1; i < argc;)
+    {
+        std::string arg = argv[i];
+        if (arg == "--scale" && i + 1 < argc)
+        {
+            scale = std::stoul(argv[i + 1]);
+            i += 2;
+        }
+        else
+        {
+            failure("Unknown argument: %s", argv[i]);
+        }
+    }
+
+    report("hashtable/probe-heavy", bench_hashtable_inserts(scale * 2000000, false));
+    report("hashtable/collision-heavy", bench_hashtable_inserts(scale * 4000, true));
+    report("hashtable/hits", bench_hashtable_hits(scale * 50000, scale * 8000000));
+    report("hashtable/pack", bench_pack(scale * 2000000, 1));
+    report("hashtable/pack-threads", bench_pack(scale * 2000000, bench_threads));
+    report("rank/std-sort", bench_rank(scale * 4000000, 1, false));
+    report("rank/radix", bench_rank(scale * 4000000, 1, true));
+    report("rank/radix-threads", bench_rank(scale * 4000000, bench_threads, true));
+
+    std::vector<uint8_t> chain = jump_chain_code(scale * 2000000, 4);
+    report("find_reachable/jump-chain", bench_find_reachable(chain, 1));
+    report("find_reachable/jump-chain-threads", bench_find_reachable(chain, bench_threads));
+    std::vector<uint8_t> branches = branchy_code(scale * 2000000, 5);
+    report("find_reachable/branches", bench_find_reachable(branches, 1));
+    report("find_reachable/branches-threads", bench_find_reachable(branches, bench_threads));
+
+    std::vector<uint8_t> dense = straight_line_code(scale * 20000000, 1000, 1.0, 6);
+    std::vector<uint8_t> sparse = straight_line_code(scale * 20000000, 1000, 0.01, 7);
+    report("count_occurrences/dense", bench_count_occurrences(dense, 1));
+    report("count_occurrences/dense-threads", bench_count_occurrences(dense, bench_threads));
+    report("count_occurrences/sparse", bench_count_occurrences(sparse, 1));
+
+    std::vector<uint8_t> printed = straight_line_code(scale * 5000000, 1000000, 1.0, 8);
+    report("print/text", bench_print(printed, output_format::text));
+    report("print/json", bench_print(printed, output_format::json));
+    report("print/binary", bench_print(printed, output_format::binary));
+}
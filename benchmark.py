@@ -0,0 +1,40 @@
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+if len(sys.argv) < 2:
+    print("Usage: benchmark.py <min_file_size> [reachable_fraction...]")
+    sys.exit(1)
+
+min_file_size = sys.argv[1]
+reachable_fractions = sys.argv[2:] or ["1.0", "0.5", "0.1", "0.01"]
+
+with tempfile.TemporaryDirectory() as directory:
+    for fraction in reachable_fractions:
+        file = os.path.join(directory, f"{fraction}.bc")
+        subprocess.run(
+            [
+                "build/lama-insnfreq-generate",
+                "--size",
+                min_file_size,
+                "--reachable",
+                fraction,
+                "--output",
+                file,
+            ],
+            check=True,
+        )
+
+        start = time.perf_counter()
+        subprocess.run(
+            ["build/lama-insnfreq-analysis", "--input", file, "--threshold", "4294967295"],
+            check=True,
+        )
+        elapsed = time.perf_counter() - start
+
+        size = os.path.getsize(file)
+        print(
+            f"reachable fraction {fraction}: {elapsed:.2f} s, {size / elapsed / 1e6:.0f} MB/s"
+        )
@@ -1,12 +1,34 @@
 #include "bytefile.hpp"
 #include "assertions.hpp"
 
+#include <algorithm>
 #include <cerrno>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <limits>
 #include <new>
-#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+void content_deleter::operator()(uint8_t* content) const
+{
+    if (is_borrowed)
+    {
+        return;
+    }
+    if (mapped_size)
+    {
+        munmap(content, mapped_size);
+    }
+    else
+    {
+        delete[] content;
+    }
+}
 
 static int read_uint32_t(FILE* f, uint32_t& out)
 {
@@ -19,6 +41,47 @@ static int read_uint32_t(FILE* f, uint32_t& out)
     return 0;
 }
 
+static constexpr size_t header_size = 3 * sizeof(uint32_t);
+
+static void read_header(uint8_t const* header, bytefile& bytefile)
+{
+    bytefile.stringtab_size = le_bytes_to_uint32_t(header);
+    bytefile.public_symbols_number = le_bytes_to_uint32_t(header + 2 * sizeof(uint32_t));
+}
+
+/**
+ * Returns false if the file can't be mapped,
+ * e.g. if it is not a regular file.
+ */
+static bool map_file_content(FILE* f, bytefile& bytefile, size_t& size)
+{
+    struct stat file_stat;
+    if (fstat(fileno(f), &file_stat) == -1 || !S_ISREG(file_stat.st_mode) ||
+        file_stat.st_size == 0)
+    {
+        return false;
+    }
+
+    size_t file_size = file_stat.st_size;
+    void* mapping = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+    if (mapping == MAP_FAILED)
+    {
+        return false;
+    }
+    bytefile.content = std::unique_ptr<uint8_t[], content_deleter>(
+        static_cast<uint8_t*>(mapping), content_deleter{file_size}
+    );
+
+    if (file_size < header_size)
+    {
+        failure("Unable to read input file header");
+    }
+    read_header(bytefile.content.get(), bytefile);
+    bytefile.public_area_ptr = bytefile.content.get() + header_size;
+    size = file_size - header_size;
+    return true;
+}
+
 static size_t read_file_content(FILE* f, bytefile& bytefile)
 {
     long ftold_size;
@@ -43,7 +106,7 @@ static size_t read_file_content(FILE* f, bytefile& bytefile)
 
     try
     {
-        bytefile.content = std::make_unique<uint8_t[]>(size);
+        bytefile.content = std::unique_ptr<uint8_t[], content_deleter>(new uint8_t[size]);
     }
     catch (std::bad_alloc&)
     {
@@ -55,14 +118,79 @@ static size_t read_file_content(FILE* f, bytefile& bytefile)
         failure("Unable to read input file content");
     }
 
+    bytefile.public_area_ptr = bytefile.content.get();
     return size;
 }
 
-bytefile read_file(FILE* f)
+constexpr size_t stream_initial_capacity = 16 << 20;
+constexpr int stream_pipe_size = 1 << 20;
+
+/**
+ * Reads a stream to its end into an anonymous mapping,
+ * which doubles by `mremap` without copying when it gets full.
+ * Nothing overlaps the reading: the code length, which sizes
+ * the bitsets and the table, is only known at the end of the stream.
+ */
+static size_t read_stream_content(FILE* f, bytefile& bytefile)
 {
-    bytefile result;
-    size_t size = read_file_content(f, result);
+    int fd = fileno(f);
+    // A larger pipe buffer lets every read take more than the default 64 KB.
+    fcntl(fd, F_SETPIPE_SZ, stream_pipe_size);
+
+    size_t capacity = stream_initial_capacity;
+    void* mapping =
+        mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED)
+    {
+        failure("Unable to allocate memory for input file content");
+    }
+    uint8_t* data = static_cast<uint8_t*>(mapping);
+    size_t size = 0;
+    while (true)
+    {
+        if (size == capacity)
+        {
+            mapping = mremap(data, capacity, capacity * 2, MREMAP_MAYMOVE);
+            if (mapping == MAP_FAILED)
+            {
+                failure("Unable to allocate memory for input file content");
+            }
+            data = static_cast<uint8_t*>(mapping);
+            capacity *= 2;
+        }
+
+        ssize_t count = read(fd, data + size, capacity - size);
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (count < 0)
+        {
+            failure("Unable to read input file content. Reason: %s", strerror(errno));
+        }
+        if (count == 0)
+        {
+            break;
+        }
+        size += count;
+    }
+
+    bytefile.content =
+        std::unique_ptr<uint8_t[], content_deleter>(data, content_deleter{capacity});
+    if (size < header_size)
+    {
+        failure("Unable to read input file header");
+    }
+    read_header(data, bytefile);
+    bytefile.public_area_ptr = data + header_size;
+    return size - header_size;
+}
 
+/**
+ * Finds the string table and the code in the `size` bytes after the header.
+ */
+static void locate_code(bytefile& result, size_t size)
+{
     uint32_t public_area_size = result.public_symbols_number * 2 * sizeof(uint32_t);
     if (size < public_area_size)
     {
@@ -76,10 +204,54 @@ bytefile read_file(FILE* f)
     }
     size -= result.stringtab_size;
 
+    if (size > std::numeric_limits<offset_t>::max())
+    {
+        failure("Input file code is larger than 4 GB, rebuild with WIDE_OFFSETS");
+    }
     result.code_length = size;
-    result.public_area_ptr = &result.content[0];
-    uint8_t* string_ptr = &result.content[public_area_size];
+    uint8_t* string_ptr = result.public_area_ptr + public_area_size;
     result.code_ptr = string_ptr + result.stringtab_size;
+}
+
+bytefile read_file(FILE* f)
+{
+    bytefile result;
+    size_t size;
+    if (!map_file_content(f, result, size))
+    {
+        bool is_seekable = fseek(f, 0, SEEK_CUR) == 0;
+        size = is_seekable ? read_file_content(f, result) : read_stream_content(f, result);
+    }
+    locate_code(result, size);
+    return result;
+}
 
+bytefile read_buffer(uint8_t const* data, size_t size)
+{
+    if (size < header_size)
+    {
+        failure("Unable to read input file header");
+    }
+    bytefile result;
+    uint8_t* content = const_cast<uint8_t*>(data);
+    result.content =
+        std::unique_ptr<uint8_t[], content_deleter>(content, content_deleter{0, true});
+    read_header(content, result);
+    result.public_area_ptr = content + header_size;
+    locate_code(result, size - header_size);
     return result;
 }
+
+void advise_code_access(bytefile const& bytefile, access_pattern pattern)
+{
+    if (!bytefile.content.get_deleter().mapped_size)
+    {
+        return;
+    }
+
+    uintptr_t page_size = sysconf(_SC_PAGESIZE);
+    uintptr_t begin = reinterpret_cast<uintptr_t>(bytefile.code_ptr) & ~(page_size - 1);
+    uintptr_t end = reinterpret_cast<uintptr_t>(bytefile.code_ptr) + bytefile.code_length;
+    int advice = pattern == access_pattern::random ? MADV_RANDOM : MADV_SEQUENTIAL;
+    madvise(reinterpret_cast<void*>(begin), end - begin, advice);
+}
@@ -6,19 +6,62 @@
 #include <cstdio>
 #include <memory>
 
+/**
+ * Offsets into the code.
+ * Build with WIDE_OFFSETS to support code larger than 4 GB.
+ */
+#ifdef WIDE_OFFSETS
+using offset_t = uint64_t;
+#else
+using offset_t = uint32_t;
+#endif
+
+/**
+ * Unmaps the content if it has been mapped, deletes it otherwise.
+ * Borrowed content belongs to the caller and is left as it is.
+ */
+struct content_deleter
+{
+    size_t mapped_size = 0;
+    bool is_borrowed = false;
+
+    void operator()(uint8_t* content) const;
+};
+
+enum class access_pattern
+{
+    random,
+    sequential
+};
+
 struct bytefile
 {
-    std::unique_ptr<uint8_t[]> content;
+    std::unique_ptr<uint8_t[], content_deleter> content;
     uint8_t* public_area_ptr;
     uint8_t* code_ptr;
     uint32_t stringtab_size;
     uint32_t public_symbols_number;
-    uint32_t code_length;
-    uint32_t ip;
+    offset_t code_length;
 };
 
+/**
+ * Maps the file into memory if possible, reads it otherwise.
+ * A stream that can't be seeked, like a pipe, is read to its end into a growing mapping.
+ */
 bytefile read_file(FILE* f);
 
+/**
+ * Uses the bytes of a whole file in place, without copying them.
+ * They are never written and have to outlive the bytefile.
+ */
+bytefile read_buffer(uint8_t const* data, size_t size);
+
+/**
+ * Tells the kernel how the code is going to be accessed
+ * if the content is mapped.
+ */
+void advise_code_access(bytefile const& bytefile, access_pattern pattern);
+
 inline uint32_t le_bytes_to_uint32_t(uint8_t const* bytes)
 {
     return static_cast<uint32_t>(bytes[0]) | (static_cast<uint32_t>(bytes[1]) << 8) |
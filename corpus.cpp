@@ -0,0 +1,60 @@
+#include "corpus.hpp"
+#include "assertions.hpp"
+
+#include <algorithm>
+#include <limits>
+
+corpus::corpus(size_t memory_limit)
+    : table(
+          initial_hashtable_size,
+          std::min<uint64_t>(
+              std::numeric_limits<offset_t>::max(),
+              growable_entries(memory_limit / 2, sizeof(hashtable_entry))
+          )
+      ),
+      max_key_bytes(memory_limit / 2)
+{
+}
+
+/**
+ * The key bytes are appended before the lookup,
+ * so that the table compares them within a single buffer.
+ * They are dropped again if the key is already known.
+ *
+ * Packed entries come in the order of their hashes.
+ * Inserted into a smaller table, they would pile up into a single probing run,
+ * so the table is grown to fit all of them first.
+ */
+void corpus::add(hashtable_entry const* entries, offset_t count, uint8_t const* code_ptr)
+{
+    table.reserve(table.used + count);
+    for (offset_t i = 0; i < count; ++i)
+    {
+        hashtable_key const& key = entries[i].key;
+        size_t ip = key_bytes.size();
+        if (ip + key.length > std::numeric_limits<offset_t>::max())
+        {
+            failure("The corpus keys don't fit into offsets, rebuild with WIDE_OFFSETS");
+        }
+        if (ip + key.length > max_key_bytes)
+        {
+            failure("The corpus keys don't fit into the memory limit");
+        }
+        key_bytes.insert(key_bytes.end(), code_ptr + key.ip, code_ptr + key.ip + key.length);
+
+        offset_t used = table.used;
+        table.add_occurrences(
+            key_bytes.data(), hash_bytes(key_bytes.data() + ip, key.length), ip, key.length,
+            entries[i].value
+        );
+        if (table.used == used)
+        {
+            key_bytes.resize(ip);
+        }
+    }
+}
+
+offset_t corpus::pack(unsigned threads)
+{
+    return table.pack(threads);
+}
@@ -0,0 +1,45 @@
+#ifndef CORPUS_HPP
+#define CORPUS_HPP
+
+#include "analyzer.hpp"
+#include "bytefile.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Counts of the keys of many files, compared by their bytes.
+ *
+ * The bytes of every distinct key are copied once into `key_bytes`,
+ * which serves as the code for `table`. A key keeps the offset
+ * of its first addition, so the files should be added in a fixed order.
+ */
+struct corpus
+{
+    std::vector<uint8_t> key_bytes;
+    hashtable table;
+
+    /**
+     * The most key bytes that fit into the memory limit.
+     */
+    size_t max_key_bytes;
+
+    /**
+     * The table and the key bytes take half of `memory_limit` each.
+     */
+    corpus(size_t memory_limit);
+
+    /**
+     * Adds the counts of the given entries, whose keys are read from `code_ptr`.
+     * The totals stop at `UINT32_MAX`, see `hashtable::is_saturated`.
+     */
+    void add(hashtable_entry const* entries, offset_t count, uint8_t const* code_ptr);
+
+    /**
+     * Moves all keys to the beginning of `table.entries` and returns their number.
+     */
+    offset_t pack(unsigned threads = 1);
+};
+
+#endif
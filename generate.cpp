@@ -0,0 +1,506 @@
+#include "arguments.hpp"
+#include "assertions.hpp"
+#include "handler.hpp"
+
+#include <array>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <vector>
+
+/**
+ * Generates synthetic bytecode files of the same shape as `generate.py`:
+ * no strings, no globals, a single public symbol at offset 0,
+ * then the code followed by an `END`.
+ *
+ * The code before the first `END` is reachable by falling through,
+ * and every jump targets a reachable instruction.
+ * Only the instructions that don't break the flow are generated.
+ * The code is written in chunks as it is generated,
+ * so the memory usage doesn't depend on the file size.
+ */
+
+constexpr size_t chunk_size = 4 << 20;
+
+/**
+ * Jump targets are drawn from a uniform sample
+ * of the reachable instructions generated so far.
+ */
+constexpr size_t target_samples = 1 << 20;
+
+/**
+ * splitmix64.
+ */
+struct random_source
+{
+    uint64_t state;
+
+    uint64_t next()
+    {
+        uint64_t z = (state += 0x9E3779B97F4A7C15);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+        return z ^ (z >> 31);
+    }
+
+    /**
+     * Uniform in [0, bound).
+     */
+    uint64_t below(uint64_t bound)
+    {
+        return static_cast<uint64_t>((static_cast<unsigned __int128>(next()) * bound) >> 64);
+    }
+
+    /**
+     * Uniform in [0, 1).
+     */
+    double fraction()
+    {
+        return (next() >> 11) * 0x1.0p-53;
+    }
+};
+
+/**
+ * Picks an index with the probability proportional to its weight
+ * from a single random number (Vose's alias method).
+ * The high bits choose a column, and the low 32 bits
+ * choose between the column and its alias without a branch.
+ */
+struct weighted_choice
+{
+    std::vector<uint64_t> thresholds;
+    std::vector<unsigned> aliases;
+
+    explicit weighted_choice(std::vector<double> const& weights)
+        : thresholds(weights.size()), aliases(weights.size())
+    {
+        double total = 0;
+        for (double weight : weights)
+        {
+            total += weight;
+        }
+        std::vector<double> probabilities(weights.size());
+        std::vector<unsigned> small;
+        std::vector<unsigned> large;
+        for (unsigned i = 0; i < weights.size(); ++i)
+        {
+            probabilities[i] = weights[i] * weights.size() / total;
+            aliases[i] = i;
+            (probabilities[i] < 1 ? small : large).push_back(i);
+        }
+        while (!small.empty() && !large.empty())
+        {
+            unsigned less = small.back();
+            unsigned more = large.back();
+            small.pop_back();
+            aliases[less] = more;
+            probabilities[more] -= 1 - probabilities[less];
+            if (probabilities[more] < 1)
+            {
+                large.pop_back();
+                small.push_back(more);
+            }
+        }
+        // What is left is 1 up to rounding errors.
+        for (unsigned i : small)
+        {
+            probabilities[i] = 1;
+        }
+        for (unsigned i : large)
+        {
+            probabilities[i] = 1;
+        }
+        for (unsigned i = 0; i < weights.size(); ++i)
+        {
+            thresholds[i] = static_cast<uint64_t>(probabilities[i] * 0x1.0p32);
+        }
+    }
+
+    unsigned pick(random_source& random) const
+    {
+        uint64_t bits = random.next();
+        unsigned i = (static_cast<uint64_t>(bits >> 32) * thresholds.size()) >> 32;
+        return static_cast<uint32_t>(bits) < thresholds[i] ? i : aliases[i];
+    }
+};
+
+/**
+ * A uniform sample of the instructions seen so far.
+ * Once it is full, the number of instructions to skip before the next replacement
+ * is drawn directly (Li's algorithm L), so most instructions cost a single comparison.
+ * The sample doesn't fit into the cache, so the slots of the next replacement
+ * and of the next pick are drawn in advance and prefetched.
+ */
+struct target_sample
+{
+    std::vector<uint32_t> targets;
+    uint64_t seen = 0;
+    uint64_t next_replaced = 0;
+    uint64_t replaced_slot = 0;
+    uint64_t picked_slot = 0;
+    double w = 1;
+
+    void add(uint32_t ip, random_source& random)
+    {
+        uint64_t index = seen++;
+        if (targets.size() < target_samples)
+        {
+            targets.push_back(ip);
+            if (targets.size() == target_samples)
+            {
+                skip(random);
+            }
+        }
+        else if (index == next_replaced)
+        {
+            targets[replaced_slot] = ip;
+            skip(random);
+        }
+    }
+
+    void skip(random_source& random)
+    {
+        w *= std::exp(std::log(open_fraction(random)) / target_samples);
+        next_replaced = seen + static_cast<uint64_t>(
+                                   std::log(open_fraction(random)) / std::log1p(-w)
+                               );
+        replaced_slot = random.below(target_samples);
+        __builtin_prefetch(&targets[replaced_slot], 1);
+    }
+
+    uint32_t pick(random_source& random)
+    {
+        if (targets.empty())
+        {
+            return 0;
+        }
+        // The sample only grows, so the slot drawn earlier is still in it.
+        uint32_t target = targets[picked_slot];
+        picked_slot = random.below(targets.size());
+        __builtin_prefetch(&targets[picked_slot]);
+        return target;
+    }
+
+    /**
+     * Uniform in (0, 1).
+     */
+    static double open_fraction(random_source& random)
+    {
+        return (random.fraction() * 0x1.0p53 + 0.5) * 0x1.0p-53;
+    }
+};
+
+struct generator_options
+{
+    uint64_t size = 0;
+
+    /**
+     * The part of the code before the first `END`.
+     */
+    double reachable_fraction = 1.0;
+
+    /**
+     * The probability of an instruction with a target.
+     * Without it, such instructions are picked by their weights like all the others.
+     */
+    std::optional<double> jump_density;
+
+    /**
+     * Operands are drawn from [0, operand_cardinality), or are arbitrary 32-bit values if it is 0.
+     * Fewer distinct operands mean fewer unique keys.
+     */
+    uint64_t operand_cardinality = 0;
+
+    uint64_t seed = 1;
+
+    /**
+     * Indexed by the dense opcode index.
+     */
+    std::array<double, instruction_count> weights;
+};
+
+/**
+ * What the generator needs to know about an instruction, looked up once per pick.
+ */
+struct generated_instruction
+{
+    uint8_t opcode;
+
+    /**
+     * Including the opcode.
+     */
+    uint8_t length;
+
+    bool has_target;
+    bool has_captures;
+};
+
+/**
+ * Every instruction is written as an opcode and two operands,
+ * and the next one starts after its actual length.
+ */
+constexpr unsigned max_generated_length = 9;
+
+/**
+ * Generated instructions with their weights.
+ */
+struct instruction_pool
+{
+    std::vector<generated_instruction> instructions;
+    std::vector<double> weights;
+
+    bool is_empty() const
+    {
+        for (double weight : weights)
+        {
+            if (weight > 0)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+/**
+ * Parses `MNEMONIC=WEIGHT,...`. The instructions that are not listed keep their weights.
+ */
+static void parse_weights(char const* text, generator_options& options)
+{
+    std::string list = text;
+    for (size_t begin = 0; begin < list.size();)
+    {
+        size_t end = std::min(list.find(',', begin), list.size());
+        std::string item = list.substr(begin, end - begin);
+        size_t equals_sign = item.find('=');
+        if (equals_sign == std::string::npos)
+        {
+            failure("Expected MNEMONIC=WEIGHT: %s", item.c_str());
+        }
+        std::string name = item.substr(0, equals_sign);
+        double weight = std::stod(item.substr(equals_sign + 1));
+        if (weight < 0)
+        {
+            failure("Negative weight: %s", item.c_str());
+        }
+
+        unsigned index = 0;
+        while (index < instruction_count && name != handler::mnemonic(opcodes_by_index[index]))
+        {
+            ++index;
+        }
+        if (index == instruction_count)
+        {
+            failure("Unknown instruction: %s", name.c_str());
+        }
+        if (instruction_shapes[opcodes_by_index[index]].flow == instruction_flow::stop)
+        {
+            failure("%s breaks the flow and is never generated", name.c_str());
+        }
+        options.weights[index] = weight;
+        begin = end + 1;
+    }
+}
+
+static void store_u32(uint8_t* at, uint32_t value)
+{
+    for (int i = 0; i < 4; ++i)
+    {
+        at[i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+}
+
+/**
+ * Fastrange of 32 random bits, so one random number gives both operands.
+ */
+static uint32_t operand(uint64_t bits, uint64_t cardinality)
+{
+    return (static_cast<uint32_t>(bits) * cardinality) >> 32;
+}
+
+static void generate(generator_options const& options, FILE* file)
+{
+    instruction_pool jumps;
+    instruction_pool others;
+    for (unsigned index = 0; index < instruction_count; ++index)
+    {
+        uint8_t opcode = opcodes_by_index[index];
+        instruction_shape const& shape = instruction_shapes[opcode];
+        if (shape.flow == instruction_flow::stop)
+        {
+            continue;
+        }
+        instruction_pool& pool = shape.has_target && options.jump_density ? jumps : others;
+        pool.instructions.push_back(
+            {opcode, static_cast<uint8_t>(1 + shape.operands_length), shape.has_target,
+             shape.has_captures}
+        );
+        pool.weights.push_back(options.weights[index]);
+    }
+    double jump_density = options.jump_density.value_or(0);
+    if ((jump_density > 0 && jumps.is_empty()) || (jump_density < 1 && others.is_empty()))
+    {
+        failure("All the weights of the instructions to generate are zero");
+    }
+    std::optional<weighted_choice> pick_jump;
+    if (jump_density > 0)
+    {
+        pick_jump.emplace(jumps.weights);
+    }
+    std::optional<weighted_choice> pick_other;
+    if (jump_density < 1)
+    {
+        pick_other.emplace(others.weights);
+    }
+
+    random_source random{options.seed};
+    target_sample targets;
+    uint64_t cardinality =
+        options.operand_cardinality != 0 ? options.operand_cardinality : uint64_t(1) << 32;
+
+    std::vector<uint8_t> chunk(chunk_size + max_generated_length);
+    uint8_t* chunk_end = chunk.data() + chunk_size;
+    uint8_t* out = chunk.data();
+    auto flush = [&]()
+    {
+        size_t used = out - chunk.data();
+        if (fwrite(chunk.data(), 1, used, file) != used)
+        {
+            failure("Failed to write the output");
+        }
+        out = chunk.data();
+    };
+
+    for (uint32_t header : {0, 0, 1, 0, 0})
+    {
+        store_u32(out, header);
+        out += 4;
+    }
+
+    uint64_t ip = 0;
+    uint64_t reachable_size = options.size * options.reachable_fraction;
+    bool is_end_placed = false;
+    while (ip < options.size)
+    {
+        if (out >= chunk_end)
+        {
+            flush();
+        }
+        if (!is_end_placed && ip >= reachable_size)
+        {
+            // Nothing falls through past this point, and nothing jumps there.
+            *out++ = opcode_end;
+            ++ip;
+            is_end_placed = true;
+            continue;
+        }
+
+        // Targets are 32-bit, so a reachable tail past 4 GB is only reached by falling through.
+        if (!is_end_placed && ip <= UINT32_MAX)
+        {
+            targets.add(ip, random);
+        }
+
+        generated_instruction const& instruction =
+            pick_jump && random.fraction() < jump_density
+                ? jumps.instructions[pick_jump->pick(random)]
+                : others.instructions[pick_other->pick(random)];
+        uint64_t bits = random.next();
+        uint32_t first = operand(bits, cardinality);
+        uint32_t second = operand(bits >> 32, cardinality);
+        if (instruction.has_target)
+        {
+            first = targets.pick(random);
+            if (instruction.has_captures)
+            {
+                second = 0;
+            }
+        }
+        out[0] = instruction.opcode;
+        store_u32(out + 1, first);
+        store_u32(out + 5, second);
+        out += instruction.length;
+        ip += instruction.length;
+    }
+    *out++ = opcode_end;
+    flush();
+}
+
+int main(int argc, char* argv[])
+{
+    generator_options options;
+    options.weights.fill(1);
+    char const* output_file = nullptr;
+
+    for (int i = 1; i < argc;)
+    {
+        std::string arg = argv[i];
+        if (i + 1 == argc)
+        {
+            failure("Missing value of %s", argv[i]);
+        }
+        if (arg == "--size")
+        {
+            options.size = parse_size(argv[i + 1]);
+        }
+        else if (arg == "--reachable")
+        {
+            options.reachable_fraction = std::stod(argv[i + 1]);
+        }
+        else if (arg == "--jump-density")
+        {
+            options.jump_density = std::stod(argv[i + 1]);
+            if (*options.jump_density < 0 || *options.jump_density > 1)
+            {
+                failure("--jump-density must be between 0 and 1");
+            }
+        }
+        else if (arg == "--operands")
+        {
+            options.operand_cardinality = std::stoull(argv[i + 1]);
+            if (options.operand_cardinality > uint64_t(1) << 32)
+            {
+                failure("--operands must be at most 2^32");
+            }
+        }
+        else if (arg == "--weights")
+        {
+            parse_weights(argv[i + 1], options);
+        }
+        else if (arg == "--seed")
+        {
+            options.seed = std::stoull(argv[i + 1]);
+        }
+        else if (arg == "--output")
+        {
+            output_file = argv[i + 1];
+        }
+        else
+        {
+            failure("Unknown argument: %s", argv[i]);
+        }
+        i += 2;
+    }
+
+    if (options.size == 0)
+    {
+        failure("--size not specified");
+    }
+
+    FILE* file = stdout;
+    if (output_file != nullptr)
+    {
+        file = fopen(output_file, "wb");
+        if (file == nullptr)
+        {
+            failure("Failed to open output file: %s", output_file);
+        }
+    }
+    generate(options, file);
+    if (fclose(file) != 0)
+    {
+        failure("Failed to write the output");
+    }
+}
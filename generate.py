@@ -3,11 +3,12 @@ import instructions
 import struct
 import sys
 
-if len(sys.argv) != 2:
-    print("Usage: generate.py <min_file_size>")
+if len(sys.argv) not in [2, 3]:
+    print("Usage: generate.py <min_file_size> [reachable_fraction]")
     sys.exit(1)
 
 min_file_size = int(sys.argv[1])
+reachable_fraction = float(sys.argv[2]) if len(sys.argv) == 3 else 1.0
 
 instruction_lengths = {
     "ADD": 0,
@@ -73,8 +74,14 @@ sys.stdout.buffer.write(struct.pack("i", 0))
 
 code = bytearray()
 insn_begins = []
+reachable_insns = None
 
 while len(code) < min_file_size:
+    if reachable_insns is None and len(code) >= min_file_size * reachable_fraction:
+        # Nothing falls through past this point, and nothing jumps there
+        reachable_insns = len(insn_begins)
+        code.append(instructions.by_mnemonic["END"][0])
+        continue
     insn_begins.append(len(code))
     random_insn = random.randint(0, len(instruction_mnemonics) - 1)
     mnemonic = instruction_mnemonics[random_insn]
@@ -82,10 +89,13 @@ while len(code) < min_file_size:
     arg_length = instruction_lengths[mnemonic]
     code.extend(random.randbytes(arg_length))
 
+if reachable_insns is None:
+    reachable_insns = len(insn_begins)
+
 for begin in insn_begins:
     mnemonic = instructions.by_opcode[code[begin]][0]
     if mnemonic in ["JMP", "CJMP_Z", "CJMP_NZ", "CALL", "CLOSURE"]:
-        target = random.choice(insn_begins)
+        target = insn_begins[random.randrange(reachable_insns)]
         struct.pack_into("i", code, begin + 1, target)
     if mnemonic in ["CLOSURE"]:
         struct.pack_into("i", code, begin + 5, 0)
@@ -0,0 +1,358 @@
+#ifndef HANDLER_HPP
+#define HANDLER_HPP
+
+#include "analyzer.hpp"
+#include "assertions.hpp"
+#include "bytefile.hpp"
+#include "report.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Everything the analysis needs to know about an instruction
+ * to skip it and to follow the control flow.
+ */
+struct instruction_shape
+{
+    bool is_known = false;
+
+    /**
+     * Not including the opcode and the captures.
+     */
+    uint8_t operands_length = 0;
+
+    /**
+     * The second operand is the number of captures,
+     * each taking 5 bytes after the operands.
+     */
+    bool has_captures = false;
+
+    /**
+     * The first operand is the target.
+     */
+    bool has_target = false;
+
+    instruction_flow flow = instruction_flow::normal;
+
+    char const* mnemonic = nullptr;
+
+    /**
+     * The dense index of the opcode among the known ones.
+     */
+    uint8_t index = 0;
+};
+
+/**
+ * `print` is one of the `PRINT_*` macros below.
+ * The shape of the instruction is derived from it
+ * by pasting `SHAPE_` before the macro name.
+ */
+#define INSTRUCTION(name, opcode, print)                                                           \
+    constexpr uint8_t opcode_##name = opcode;                                                      \
+    constexpr instruction_shape shape_##name = SHAPE_##print;                                      \
+                                                                                                   \
+    inline void print_##name(reader_t& reader, report_writer& output)                              \
+    {                                                                                              \
+        print                                                                                      \
+    }
+
+#define PRINT_NOARG(description) output.mnemonic(description);
+
+#define PRINT_1ARG(description)                                                                    \
+    uint32_t arg1 = reader.next_code_uint32_t();                                                   \
+    output.mnemonic(description);                                                                  \
+    output.operand(arg1);
+
+#define PRINT_2ARG(description)                                                                    \
+    uint32_t arg1 = reader.next_code_uint32_t();                                                   \
+    uint32_t arg2 = reader.next_code_uint32_t();                                                   \
+    output.mnemonic(description);                                                                  \
+    output.operand(arg1);                                                                          \
+    output.operand(arg2);
+
+#define PRINT_CLOSURE                                                                              \
+    uint32_t target = reader.next_code_uint32_t();                                                 \
+    uint32_t args_size = reader.next_code_uint32_t();                                              \
+    output.mnemonic("CLOSURE");                                                                    \
+    output.operand(target);                                                                        \
+    output.operand(args_size);                                                                     \
+    for (uint32_t i = 0; i < args_size; ++i)                                                       \
+    {                                                                                              \
+        uint8_t designation = reader.next_code_byte();                                             \
+        uint32_t index = reader.next_code_uint32_t();                                              \
+        output.operand(designation);                                                               \
+        output.operand(index);                                                                     \
+    }
+
+#define SHAPE_PRINT_NOARG(description)                                                             \
+    instruction_shape{true, 0, false, false, instruction_flow::normal, description}
+#define SHAPE_PRINT_1ARG(description)                                                              \
+    instruction_shape{true, 4, false, false, instruction_flow::normal, description}
+#define SHAPE_PRINT_2ARG(description)                                                              \
+    instruction_shape{true, 8, false, false, instruction_flow::normal, description}
+#define SHAPE_PRINT_CLOSURE                                                                        \
+    instruction_shape{true, 8, true, false, instruction_flow::normal, "CLOSURE"}
+
+INSTRUCTION(add, 0x01, PRINT_NOARG("ADD"))
+INSTRUCTION(sub, 0x02, PRINT_NOARG("SUB"))
+INSTRUCTION(mul, 0x03, PRINT_NOARG("MUL"))
+INSTRUCTION(div, 0x04, PRINT_NOARG("DIV"))
+INSTRUCTION(rem, 0x05, PRINT_NOARG("REM"))
+INSTRUCTION(lt, 0x06, PRINT_NOARG("LT"))
+INSTRUCTION(leq, 0x07, PRINT_NOARG("LEQ"))
+INSTRUCTION(gt, 0x08, PRINT_NOARG("GT"))
+INSTRUCTION(geq, 0x09, PRINT_NOARG("GEQ"))
+INSTRUCTION(eq, 0x0A, PRINT_NOARG("EQ"))
+INSTRUCTION(neq, 0x0B, PRINT_NOARG("NEQ"))
+INSTRUCTION(and, 0x0C, PRINT_NOARG("AND"))
+INSTRUCTION(or, 0x0D, PRINT_NOARG("OR"))
+
+INSTRUCTION(const, 0x10, PRINT_1ARG("CONST"))
+INSTRUCTION(string, 0x11, PRINT_1ARG("STRING"))
+INSTRUCTION(sexp, 0x12, PRINT_2ARG("SEXP"))
+INSTRUCTION(sta, 0x14, PRINT_NOARG("STA"))
+INSTRUCTION(jmp, 0x15, PRINT_1ARG("JMP"))
+INSTRUCTION(end, 0x16, PRINT_NOARG("END"))
+INSTRUCTION(ret, 0x17, PRINT_NOARG("RET"))
+INSTRUCTION(drop, 0x18, PRINT_NOARG("DROP"))
+INSTRUCTION(dup, 0x19, PRINT_NOARG("DUP"))
+INSTRUCTION(swap, 0x1A, PRINT_NOARG("SWAP"))
+INSTRUCTION(elem, 0x1B, PRINT_NOARG("ELEM"))
+
+INSTRUCTION(ld_global, 0x20, PRINT_1ARG("LD_GLOBAL"))
+INSTRUCTION(ld_local, 0x21, PRINT_1ARG("LD_LOCAL"))
+INSTRUCTION(ld_arg, 0x22, PRINT_1ARG("LD_ARG"))
+INSTRUCTION(ld_capture, 0x23, PRINT_1ARG("LD_CAPTURE"))
+
+INSTRUCTION(st_global, 0x40, PRINT_1ARG("ST_GLOBAL"))
+INSTRUCTION(st_local, 0x41, PRINT_1ARG("ST_LOCAL"))
+INSTRUCTION(st_arg, 0x42, PRINT_1ARG("ST_ARG"))
+INSTRUCTION(st_capture, 0x43, PRINT_1ARG("ST_CAPTURE"))
+
+INSTRUCTION(cjmp_z, 0x50, PRINT_1ARG("CJMP_Z"))
+INSTRUCTION(cjmp_nz, 0x51, PRINT_1ARG("CJMP_NZ"))
+INSTRUCTION(begin, 0x52, PRINT_2ARG("BEGIN"))
+INSTRUCTION(beginc, 0x53, PRINT_2ARG("BEGINC"))
+INSTRUCTION(closure, 0x54, PRINT_CLOSURE)
+INSTRUCTION(callc, 0x55, PRINT_1ARG("CALLC"))
+INSTRUCTION(call, 0x56, PRINT_2ARG("CALL"))
+INSTRUCTION(tag, 0x57, PRINT_2ARG("TAG"))
+INSTRUCTION(array, 0x58, PRINT_1ARG("ARRAY"))
+INSTRUCTION(fail, 0x59, PRINT_2ARG("FAIL"))
+INSTRUCTION(line, 0x5A, PRINT_1ARG("LINE"))
+
+INSTRUCTION(pattern_strcmp, 0x60, PRINT_NOARG("PATTERN_STRCMP"))
+INSTRUCTION(pattern_string, 0x61, PRINT_NOARG("PATTERN_STRING"))
+INSTRUCTION(pattern_array, 0x62, PRINT_NOARG("PATTERN_ARRAY"))
+INSTRUCTION(pattern_sexp, 0x63, PRINT_NOARG("PATTERN_SEXP"))
+INSTRUCTION(pattern_boxed, 0x64, PRINT_NOARG("PATTERN_BOXED"))
+INSTRUCTION(pattern_unboxed, 0x65, PRINT_NOARG("PATTERN_UNBOXED"))
+INSTRUCTION(pattern_closure, 0x66, PRINT_NOARG("PATTERN_CLOSURE"))
+
+INSTRUCTION(builtin_read, 0x70, PRINT_NOARG("BUILTIN_READ"))
+INSTRUCTION(builtin_write, 0x71, PRINT_NOARG("BUILTIN_WRITE"))
+INSTRUCTION(builtin_length, 0x72, PRINT_NOARG("BUILTIN_LENGTH"))
+INSTRUCTION(builtin_string, 0x73, PRINT_NOARG("BUILTIN_STRING"))
+INSTRUCTION(builtin_array, 0x74, PRINT_1ARG("BUILTIN_ARRAY"))
+
+#define FOR_EACH_INSTRUCTION(X)                                                                    \
+    X(add)                                                                                         \
+    X(sub)                                                                                         \
+    X(mul)                                                                                         \
+    X(div)                                                                                         \
+    X(rem)                                                                                         \
+    X(lt)                                                                                          \
+    X(leq)                                                                                         \
+    X(gt)                                                                                          \
+    X(geq)                                                                                         \
+    X(eq)                                                                                          \
+    X(neq)                                                                                         \
+    X(and)                                                                                         \
+    X(or)                                                                                          \
+    X(const)                                                                                       \
+    X(string)                                                                                      \
+    X(sexp)                                                                                        \
+    X(sta)                                                                                         \
+    X(jmp)                                                                                         \
+    X(end)                                                                                         \
+    X(ret)                                                                                         \
+    X(drop)                                                                                        \
+    X(dup)                                                                                         \
+    X(swap)                                                                                        \
+    X(elem)                                                                                        \
+    X(ld_global)                                                                                   \
+    X(ld_local)                                                                                    \
+    X(ld_arg)                                                                                      \
+    X(ld_capture)                                                                                  \
+    X(st_global)                                                                                   \
+    X(st_local)                                                                                    \
+    X(st_arg)                                                                                      \
+    X(st_capture)                                                                                  \
+    X(cjmp_z)                                                                                      \
+    X(cjmp_nz)                                                                                     \
+    X(begin)                                                                                       \
+    X(beginc)                                                                                      \
+    X(closure)                                                                                     \
+    X(callc)                                                                                       \
+    X(call)                                                                                        \
+    X(tag)                                                                                         \
+    X(array)                                                                                       \
+    X(fail)                                                                                        \
+    X(line)                                                                                        \
+    X(pattern_strcmp)                                                                              \
+    X(pattern_string)                                                                              \
+    X(pattern_array)                                                                               \
+    X(pattern_sexp)                                                                                \
+    X(pattern_boxed)                                                                               \
+    X(pattern_unboxed)                                                                             \
+    X(pattern_closure)                                                                             \
+    X(builtin_read)                                                                                \
+    X(builtin_write)                                                                               \
+    X(builtin_length)                                                                              \
+    X(builtin_string)                                                                              \
+    X(builtin_array)
+
+#define COUNT(name) +1
+constexpr unsigned instruction_count = 0 FOR_EACH_INSTRUCTION(COUNT);
+#undef COUNT
+
+constexpr std::array<uint8_t, instruction_count> make_opcodes_by_index()
+{
+    std::array<uint8_t, instruction_count> opcodes{};
+    unsigned index = 0;
+
+#define OPCODE(name) opcodes[index++] = opcode_##name;
+    FOR_EACH_INSTRUCTION(OPCODE)
+#undef OPCODE
+
+    return opcodes;
+}
+
+constexpr std::array<uint8_t, instruction_count> opcodes_by_index = make_opcodes_by_index();
+
+constexpr std::array<instruction_shape, 256> make_instruction_shapes()
+{
+    std::array<instruction_shape, 256> shapes{};
+
+#define SHAPE(name) shapes[opcode_##name] = shape_##name;
+    FOR_EACH_INSTRUCTION(SHAPE)
+#undef SHAPE
+
+    for (unsigned index = 0; index < instruction_count; ++index)
+    {
+        shapes[opcodes_by_index[index]].index = index;
+    }
+
+    for (uint8_t opcode : {opcode_jmp, opcode_end, opcode_ret, opcode_fail})
+    {
+        shapes[opcode].flow = instruction_flow::stop;
+    }
+    for (uint8_t opcode : {opcode_cjmp_z, opcode_cjmp_nz, opcode_call, opcode_callc})
+    {
+        shapes[opcode].flow = instruction_flow::call;
+    }
+    for (uint8_t opcode : {opcode_jmp, opcode_cjmp_z, opcode_cjmp_nz, opcode_call, opcode_closure})
+    {
+        shapes[opcode].has_target = true;
+    }
+
+    return shapes;
+}
+
+constexpr std::array<instruction_shape, 256> instruction_shapes = make_instruction_shapes();
+
+struct handler
+{
+    static constexpr unsigned opcode_count = instruction_count;
+
+    /**
+     * The dense index of the opcode of a known instruction.
+     */
+    static unsigned opcode_index(uint8_t const* instruction)
+    {
+        return instruction_shapes[instruction[0]].index;
+    }
+
+    static uint8_t opcode_byte(unsigned index)
+    {
+        return opcodes_by_index[index];
+    }
+
+    static char const* mnemonic(uint8_t opcode)
+    {
+        return instruction_shapes[opcode].mnemonic;
+    }
+
+    /**
+     * See the "Memory Usage" section of the README.
+     */
+    static uint64_t max_entries(offset_t code_length, unsigned max_length)
+    {
+        uint64_t entries = 0;
+        uint64_t single_byte_sequences = 1;
+        for (uint64_t length = 1; length <= max_length; ++length)
+        {
+            single_byte_sequences = std::min<uint64_t>(single_byte_sequences * 256, code_length);
+            uint64_t longer_sequences = length * code_length / (length + 4);
+            entries += std::min<uint64_t>(longer_sequences + single_byte_sequences, code_length);
+        }
+        return entries;
+    }
+
+    /**
+     * Skips the instruction in a single pass.
+     */
+    instruction_result decode(reader_t& reader)
+    {
+        offset_t initial_ip = reader.ip;
+        uint8_t opcode = reader.next_code_byte();
+        instruction_shape const& shape = instruction_shapes[opcode];
+        if (!shape.is_known)
+        {
+            failure(
+                "Unknown instruction 0x%02X at offset %zu", opcode, static_cast<size_t>(initial_ip)
+            );
+        }
+        reader.skip(shape.operands_length, "instruction operands");
+
+        instruction_result result;
+        result.flow = shape.flow;
+        result.target = no_target;
+        if (shape.has_target)
+        {
+            result.target = le_bytes_to_uint32_t(reader.code + initial_ip + 1);
+        }
+        if (shape.has_captures)
+        {
+            uint32_t captures = le_bytes_to_uint32_t(reader.code + initial_ip + 5);
+            reader.skip(static_cast<uint64_t>(captures) * 5, "closure captures");
+        }
+        return result;
+    }
+
+    void print(reader_t& reader, report_writer& output)
+    {
+#define CASE(name)                                                                                 \
+    case opcode_##name:                                                                            \
+        print_##name(reader, output);                                                              \
+        break;
+
+        uint8_t opcode = reader.next_code_byte();
+
+        switch (opcode)
+        {
+            FOR_EACH_INSTRUCTION(CASE)
+        default:
+            failure(
+                "Unknown instruction 0x%02X at offset %zu", opcode,
+                static_cast<size_t>(reader.ip - 1)
+            );
+            break;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,73 @@
+#include "insnfreq.hpp"
+#include "assertions.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+bytefile load_bytefile(char const* path)
+{
+    if (strcmp(path, "-") == 0)
+    {
+        return read_file(stdin);
+    }
+    FILE* f = fopen(path, "rb");
+    if (f == nullptr)
+    {
+        failure("Failed to open input file: %s", path);
+    }
+    bytefile bf = read_file(f);
+    fclose(f);
+    return bf;
+}
+
+bytefile load_bytefile(uint8_t const* data, size_t size)
+{
+    return read_buffer(data, size);
+}
+
+/**
+ * Moving the content keeps its address, so the analyzer is made
+ * from the code of the moved input.
+ */
+file_analysis::file_analysis(bytefile&& input, size_t memory_limit, unsigned max_length)
+    : input(std::move(input)),
+      code(this->input.code_ptr, this->input.code_length, memory_limit, max_length)
+{
+}
+
+void file_analysis::find_reachable(unsigned threads)
+{
+    std::vector<offset_t> public_symbols;
+    for (uint32_t i = 0; i < input.public_symbols_number; ++i)
+    {
+        uint8_t* symbol_ptr = &input.public_area_ptr[i * 2 * sizeof(uint32_t) + sizeof(uint32_t)];
+        public_symbols.push_back(le_bytes_to_uint32_t(symbol_ptr));
+    }
+    advise_code_access(input, access_pattern::random);
+    code.find_reachable(public_symbols, threads);
+
+    advise_code_access(input, access_pattern::sequential);
+}
+
+void file_analysis::count(unsigned threads)
+{
+    code.count_occurrences(threads);
+}
+
+void file_analysis::count_pairs(unsigned threads)
+{
+    code.count_pairs(threads);
+}
+
+opcode_counts file_analysis::count_opcodes(unsigned threads)
+{
+    return code.count_opcodes(threads);
+}
+
+offset_t file_analysis::pack(unsigned threads)
+{
+    packed_size = code.pack_table(threads);
+    return packed_size;
+}
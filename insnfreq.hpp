@@ -0,0 +1,86 @@
+#ifndef INSNFREQ_HPP
+#define INSNFREQ_HPP
+
+#include "analyzer.hpp"
+#include "bytefile.hpp"
+#include "handler.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * The interface of the `lama-insnfreq` library, for callers that analyze bytefiles
+ * in their own process and take the counts as they are instead of parsing a report.
+ * Errors are reported by `failure`, as in the rest of the analysis.
+ */
+
+/**
+ * Maps the file into memory if possible, reads it otherwise.
+ * The path `-` is the standard input, which can also be a pipe.
+ */
+bytefile load_bytefile(char const* path);
+
+/**
+ * Uses the bytes of a whole bytefile in place. They have to outlive the result.
+ */
+bytefile load_bytefile(uint8_t const* data, size_t size);
+
+/**
+ * The exact analysis of a single bytefile. The phases are called in order:
+ * `find_reachable`, then `count`, `count_pairs` or `count_opcodes`,
+ * then `pack` after the exact counts.
+ */
+struct file_analysis
+{
+    bytefile input;
+    analyzer<handler> code;
+
+    /**
+     * The number of distinct keys, which are the first entries of the table after `pack`.
+     */
+    offset_t packed_size = 0;
+
+    /**
+     * `memory_limit` and `max_length` are the ones of `analyzer`.
+     */
+    explicit file_analysis(
+        bytefile&& input, size_t memory_limit = SIZE_MAX, unsigned max_length = 2
+    );
+
+    /**
+     * Explores the code from its public symbols.
+     */
+    void find_reachable(unsigned threads = 1);
+
+    void count(unsigned threads = 1);
+
+    /**
+     * Same counts as `count`, by `analyzer::count_pairs`.
+     */
+    void count_pairs(unsigned threads = 1);
+
+    opcode_counts count_opcodes(unsigned threads = 1);
+
+    offset_t pack(unsigned threads = 1);
+
+    hashtable_entry* entries() const
+    {
+        return code.table.entries.get();
+    }
+
+    /**
+     * Calls `visitor(key, length, count)` for every packed entry, in the order of the table.
+     * The key bytes point into the code of the input.
+     */
+    template <typename Visitor>
+    void visit(Visitor&& visitor) const
+    {
+        hashtable_entry const* packed = entries();
+        for (offset_t i = 0; i < packed_size; ++i)
+        {
+            visitor(input.code_ptr + packed[i].key.ip, packed[i].key.length, packed[i].value);
+        }
+    }
+};
+
+#endif
@@ -1,246 +1,572 @@
 #include "analyzer.hpp"
+#include "arguments.hpp"
 #include "assertions.hpp"
 #include "bytefile.hpp"
+#include "corpus.hpp"
+#include "handler.hpp"
+#include "insnfreq.hpp"
+#include "merge.hpp"
+#include "profile.hpp"
+#include "report.hpp"
+#include "stats.hpp"
 
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
 #include <cstdio>
 #include <cstring>
 #include <iomanip>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <random>
 #include <set>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <tuple>
 #include <unordered_map>
 #include <vector>
 
-#define INSTRUCTION(name, opcode, print)                                                           \
-    constexpr uint8_t opcode_##name = opcode;                                                      \
-                                                                                                   \
-    void print_##name(reader_t& reader, FILE* file)                                                \
-    {                                                                                              \
-        print                                                                                      \
-    }
+enum class analysis_mode
+{
+    /**
+     * Sequences of instructions with their operands.
+     */
+    exact,
+
+    /**
+     * Sequences of opcodes only.
+     */
+    opcodes
+};
+
+struct analysis_options
+{
+    analysis_mode mode = analysis_mode::exact;
+    unsigned threads = 1;
+    size_t memory_limit = SIZE_MAX;
+    unsigned max_length = 2;
+
+    /**
+     * The profile to save the analysis of a single input to.
+     */
+    char const* save_profile = nullptr;
+
+    /**
+     * The profile to report instead of analyzing, if it has been saved for the same input.
+     */
+    char const* load_profile = nullptr;
+
+    /**
+     * The mergeable profile to save the exact counts, the total ones in batch mode, to.
+     */
+    char const* save_mergeable = nullptr;
+
+    /**
+     * Takes the page faults of the analyzer memory in parallel before the analysis.
+     */
+    bool prefault = false;
+
+    /**
+     * Counts the pairs by the IDs of their instructions instead of by their bytes.
+     */
+    bool pair_ids = false;
+};
+
+struct report_options
+{
+    uint32_t threshold = 1;
+    offset_t top = no_limit;
+};
+
+/**
+ * Adds what is known about an analyzed file to the stats.
+ */
+static void record_file_stats(run_stats& stats, analyzer<handler> const& analyzer)
+{
+    stats.code_bytes += analyzer.code_size;
+    stats.instructions_visited += analyzer.visited.count(analyzer.code_size);
+    stats.bytes_decoded += analyzer.decoded_bytes;
+    stats.probes.add(analyzer.table.stats);
+}
+
+static void record_table_stats(run_stats& stats, hashtable const& table, offset_t packed_size)
+{
+    stats.has_table = true;
+    stats.table_size = table.size;
+    stats.unique_keys = packed_size;
+    stats.table_grows = table.grows;
+}
 
-#define PRINT_NOARG(description) file == nullptr ? 0 : fprintf(file, "%s", description);
-
-#define PRINT_1ARG(description)                                                                    \
-    uint32_t arg1 = reader.next_code_uint32_t();                                                   \
-    file == nullptr ? 0 : fprintf(file, "%s %u", description, arg1);
-
-#define PRINT_2ARG(description)                                                                    \
-    uint32_t arg1 = reader.next_code_uint32_t();                                                   \
-    uint32_t arg2 = reader.next_code_uint32_t();                                                   \
-    file == nullptr ? 0 : fprintf(file, "%s %u %u", description, arg1, arg2);
-
-#define PRINT_CLOSURE                                                                              \
-    uint32_t target = reader.next_code_uint32_t();                                                 \
-    uint32_t args_size = reader.next_code_uint32_t();                                              \
-    file == nullptr ? 0 : fprintf(file, "CLOSURE %u %u", target, args_size);                       \
-    for (uint32_t i = 0; i < args_size; ++i)                                                       \
-    {                                                                                              \
-        uint8_t designation = reader.next_code_byte();                                             \
-        uint32_t index = reader.next_code_uint32_t();                                              \
-        file == nullptr ? 0 : fprintf(file, " %u %u", designation, index);                         \
+/**
+ * The totals of a corpus stop at `UINT32_MAX` instead of wrapping.
+ */
+static void warn_if_saturated(bool is_saturated)
+{
+    if (is_saturated)
+    {
+        fprintf(
+            stderr, "Some total counts exceed %u and are printed as %u\n", UINT32_MAX, UINT32_MAX
+        );
     }
+}
 
-INSTRUCTION(add, 0x01, PRINT_NOARG("ADD"))
-INSTRUCTION(sub, 0x02, PRINT_NOARG("SUB"))
-INSTRUCTION(mul, 0x03, PRINT_NOARG("MUL"))
-INSTRUCTION(div, 0x04, PRINT_NOARG("DIV"))
-INSTRUCTION(rem, 0x05, PRINT_NOARG("REM"))
-INSTRUCTION(lt, 0x06, PRINT_NOARG("LT"))
-INSTRUCTION(leq, 0x07, PRINT_NOARG("LEQ"))
-INSTRUCTION(gt, 0x08, PRINT_NOARG("GT"))
-INSTRUCTION(geq, 0x09, PRINT_NOARG("GEQ"))
-INSTRUCTION(eq, 0x0A, PRINT_NOARG("EQ"))
-INSTRUCTION(neq, 0x0B, PRINT_NOARG("NEQ"))
-INSTRUCTION(and, 0x0C, PRINT_NOARG("AND"))
-INSTRUCTION(or, 0x0D, PRINT_NOARG("OR"))
-
-INSTRUCTION(const, 0x10, PRINT_1ARG("CONST"))
-INSTRUCTION(string, 0x11, PRINT_1ARG("STRING"))
-INSTRUCTION(sexp, 0x12, PRINT_2ARG("SEXP"))
-INSTRUCTION(sta, 0x14, PRINT_NOARG("STA"))
-INSTRUCTION(jmp, 0x15, PRINT_1ARG("JMP"))
-INSTRUCTION(end, 0x16, PRINT_NOARG("END"))
-INSTRUCTION(ret, 0x17, PRINT_NOARG("RET"))
-INSTRUCTION(drop, 0x18, PRINT_NOARG("DROP"))
-INSTRUCTION(dup, 0x19, PRINT_NOARG("DUP"))
-INSTRUCTION(swap, 0x1A, PRINT_NOARG("SWAP"))
-INSTRUCTION(elem, 0x1B, PRINT_NOARG("ELEM"))
-
-INSTRUCTION(ld_global, 0x20, PRINT_1ARG("LD_GLOBAL"))
-INSTRUCTION(ld_local, 0x21, PRINT_1ARG("LD_LOCAL"))
-INSTRUCTION(ld_arg, 0x22, PRINT_1ARG("LD_ARG"))
-INSTRUCTION(ld_capture, 0x23, PRINT_1ARG("LD_CAPTURE"))
-
-INSTRUCTION(st_global, 0x40, PRINT_1ARG("ST_GLOBAL"))
-INSTRUCTION(st_local, 0x41, PRINT_1ARG("ST_LOCAL"))
-INSTRUCTION(st_arg, 0x42, PRINT_1ARG("ST_ARG"))
-INSTRUCTION(st_capture, 0x43, PRINT_1ARG("ST_CAPTURE"))
-
-INSTRUCTION(cjmp_z, 0x50, PRINT_1ARG("CJMP_Z"))
-INSTRUCTION(cjmp_nz, 0x51, PRINT_1ARG("CJMP_NZ"))
-INSTRUCTION(begin, 0x52, PRINT_2ARG("BEGIN"))
-INSTRUCTION(beginc, 0x53, PRINT_2ARG("BEGINC"))
-INSTRUCTION(closure, 0x54, PRINT_CLOSURE)
-INSTRUCTION(callc, 0x55, PRINT_1ARG("CALLC"))
-INSTRUCTION(call, 0x56, PRINT_2ARG("CALL"))
-INSTRUCTION(tag, 0x57, PRINT_2ARG("TAG"))
-INSTRUCTION(array, 0x58, PRINT_1ARG("ARRAY"))
-INSTRUCTION(fail, 0x59, PRINT_2ARG("FAIL"))
-INSTRUCTION(line, 0x5A, PRINT_1ARG("LINE"))
-
-INSTRUCTION(pattern_strcmp, 0x60, PRINT_NOARG("PATTERN_STRCMP"))
-INSTRUCTION(pattern_string, 0x61, PRINT_NOARG("PATTERN_STRING"))
-INSTRUCTION(pattern_array, 0x62, PRINT_NOARG("PATTERN_ARRAY"))
-INSTRUCTION(pattern_sexp, 0x63, PRINT_NOARG("PATTERN_SEXP"))
-INSTRUCTION(pattern_boxed, 0x64, PRINT_NOARG("PATTERN_BOXED"))
-INSTRUCTION(pattern_unboxed, 0x65, PRINT_NOARG("PATTERN_UNBOXED"))
-INSTRUCTION(pattern_closure, 0x66, PRINT_NOARG("PATTERN_CLOSURE"))
-
-INSTRUCTION(builtin_read, 0x70, PRINT_NOARG("BUILTIN_READ"))
-INSTRUCTION(builtin_write, 0x71, PRINT_NOARG("BUILTIN_WRITE"))
-INSTRUCTION(builtin_length, 0x72, PRINT_NOARG("BUILTIN_LENGTH"))
-INSTRUCTION(builtin_string, 0x73, PRINT_NOARG("BUILTIN_STRING"))
-INSTRUCTION(builtin_array, 0x74, PRINT_1ARG("BUILTIN_ARRAY"))
-
-struct handler
+/**
+ * Analyzes every file with a single thread, `threads` files at a time.
+ * The per-file reports are printed and added to the corpus
+ * in the order of `inputs`, so the output doesn't depend on the scheduling.
+ * The corpus takes half of the memory limit, and the files being analyzed share the other half.
+ */
+static void analyze_corpus(
+    std::vector<std::string> const& inputs, analysis_options const& analysis,
+    report_writer& output, report_options const& options, run_stats& stats
+)
 {
-    instruction_result describe_flow(reader_t& reader)
+    stats.start_phase("analyze");
+    unsigned threads = analysis.threads;
+    bool is_opcodes = analysis.mode == analysis_mode::opcodes;
+    std::unique_ptr<corpus> total;
+    std::unique_ptr<opcode_counts> opcode_total;
+    if (is_opcodes)
+    {
+        opcode_total.reset(new opcode_counts(handler::opcode_count, analysis.max_length));
+    }
+    else
+    {
+        total.reset(new corpus(analysis.memory_limit / 2));
+    }
+
+    std::atomic<size_t> next_input{0};
+    std::mutex mutex;
+    std::condition_variable reported;
+    size_t next_report = 0;
+    auto in_order = [&](size_t i, auto report)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        reported.wait(lock, [&]() { return next_report == i; });
+        report();
+        ++next_report;
+        reported.notify_all();
+    };
+
+    auto work = [&]()
+    {
+        for (size_t i = next_input++; i < inputs.size(); i = next_input++)
+        {
+            char const* name = inputs[i].c_str();
+            file_analysis file(
+                load_bytefile(name), analysis.memory_limit / 2 / threads, analysis.max_length
+            );
+            file.find_reachable(1);
+
+            if (is_opcodes)
+            {
+                opcode_counts counts = file.count_opcodes(1);
+                in_order(
+                    i,
+                    [&]()
+                    {
+                        record_file_stats(stats, file.code);
+                        opcode_total->add(counts);
+                        print_opcode_counts<handler>(
+                            counts, output, options.threshold, options.top, name
+                        );
+                    }
+                );
+            }
+            else
+            {
+                if (analysis.pair_ids)
+                {
+                    file.count_pairs(1);
+                }
+                else
+                {
+                    file.count(1);
+                }
+                offset_t packed_size = file.pack();
+                in_order(
+                    i,
+                    [&]()
+                    {
+                        record_file_stats(stats, file.code);
+                        total->add(file.entries(), packed_size, file.input.code_ptr);
+                        file.code.print_hashtable(output, options.threshold, options.top, name);
+                    }
+                );
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned i = 1; i < threads; ++i)
+    {
+        workers.emplace_back(work);
+    }
+    work();
+    for (std::thread& worker : workers)
     {
-        instruction_result result;
-        result.target = UINT32_MAX;
-        result.flow = instruction_flow::normal;
+        worker.join();
+    }
+
+    if (is_opcodes)
+    {
+        stats.start_phase("print");
+        warn_if_saturated(opcode_total->is_saturated);
+        print_opcode_counts<handler>(
+            *opcode_total, output, options.threshold, options.top, "total"
+        );
+        stats.end_phase();
+        return;
+    }
+    stats.start_phase("pack");
+    offset_t packed_size = total->pack(threads);
+    record_table_stats(stats, total->table, packed_size);
+    stats.probes.add(total->table.stats);
+    warn_if_saturated(total->table.is_saturated);
+
+    hashtable_entry* entries = total->table.entries.get();
+    if (analysis.save_mergeable != nullptr)
+    {
+        stats.start_phase("save_mergeable");
+        save_mergeable(
+            analysis.save_mergeable, entries, packed_size, total->key_bytes.data(),
+            analysis.max_length
+        );
+    }
 
-        uint32_t initial_ip = reader.ip;
-        uint8_t opcode = reader.next_code_byte();
+    stats.start_phase("print");
+    print_entries<handler>(
+        entries, entries + packed_size, total->key_bytes.data(), total->key_bytes.size(), output,
+        options.threshold, options.top, "total", threads
+    );
+    stats.end_phase();
+}
 
-        switch (opcode)
+/**
+ * Checks the offsets of the printed keys, since nothing else reads them.
+ */
+static void
+print_profile(profile const& loaded, report_writer& output, report_options const& options)
+{
+    profile_entry const* end = loaded.entries + loaded.header->entry_count;
+    profile_entry const* begin =
+        first_printed_entry(loaded.entries, end, options.threshold, options.top);
+    for (profile_entry const* it = begin; it != end; ++it)
+    {
+        if (it->key.ip > loaded.header->key_bytes_size ||
+            it->key.length > loaded.header->key_bytes_size - it->key.ip)
         {
-        case opcode_jmp:
-        case opcode_end:
-        case opcode_ret:
-        case opcode_fail:
-            result.flow = instruction_flow::stop;
-            break;
-
-        case opcode_cjmp_z:
-        case opcode_cjmp_nz:
-        case opcode_call:
-        case opcode_callc:
-            result.flow = instruction_flow::call;
-            break;
+            failure(
+                "Profile key is out of bounds: entry %zu",
+                static_cast<size_t>(it - loaded.entries)
+            );
         }
+    }
+    print_entry_range<handler>(begin, end, loaded.key_bytes, loaded.header->key_bytes_size, output);
+}
 
-        switch (opcode)
+static void analyze_file(
+    char const* input, analysis_options const& analysis, report_writer& output,
+    report_options const& options, run_stats& stats
+)
+{
+    stats.start_phase("read");
+    bytefile bf = load_bytefile(input);
+
+    uint64_t input_hash = 0;
+    if (analysis.save_profile != nullptr || analysis.load_profile != nullptr)
+    {
+        stats.start_phase("hash");
+        input_hash = content_hash(bf);
+    }
+    if (analysis.load_profile != nullptr)
+    {
+        stats.start_phase("load_profile");
+        profile loaded = load_profile(analysis.load_profile);
+        if (loaded.header->input_hash == input_hash &&
+            loaded.header->max_length == analysis.max_length)
         {
-        case opcode_jmp:
-        case opcode_cjmp_z:
-        case opcode_cjmp_nz:
-        case opcode_call:
-        case opcode_closure:
-            result.target = reader.next_code_uint32_t();
-            break;
+            stats.start_phase("print");
+            print_profile(loaded, output, options);
+            stats.end_phase();
+            return;
         }
+        fprintf(
+            stderr, "The profile %s is for another input or --max-length, analyzing again\n",
+            analysis.load_profile
+        );
+    }
+
+    stats.start_phase(analysis.prefault ? "prefault" : "find_reachable");
+    file_analysis file(std::move(bf), analysis.memory_limit, analysis.max_length);
+    if (analysis.prefault)
+    {
+        file.code.prefault_memory(analysis.threads);
+        stats.start_phase("find_reachable");
+    }
+    file.find_reachable(analysis.threads);
 
-        reader.ip = initial_ip;
-        return result;
+    stats.start_phase("count");
+    if (analysis.mode == analysis_mode::opcodes)
+    {
+        opcode_counts counts = file.count_opcodes(analysis.threads);
+        record_file_stats(stats, file.code);
+        stats.start_phase("print");
+        print_opcode_counts<handler>(counts, output, options.threshold, options.top);
+        stats.end_phase();
+        return;
+    }
+    if (analysis.pair_ids)
+    {
+        file.count_pairs(analysis.threads);
     }
+    else
+    {
+        file.count(analysis.threads);
+    }
+    record_file_stats(stats, file.code);
+
+    stats.start_phase("pack");
+    offset_t packed_size = file.pack(analysis.threads);
+    record_table_stats(stats, file.code.table, packed_size);
 
-    void print(reader_t& reader, FILE* file)
+    hashtable_entry* entries = file.entries();
+    uint8_t* code_ptr = file.input.code_ptr;
+    offset_t code_length = file.input.code_length;
+    if (analysis.save_mergeable != nullptr)
+    {
+        stats.start_phase("save_mergeable");
+        save_mergeable(
+            analysis.save_mergeable, entries, packed_size, code_ptr, analysis.max_length
+        );
+    }
+    if (analysis.save_profile == nullptr)
     {
-#define CASE(name)                                                                                 \
-    case opcode_##name:                                                                            \
-        print_##name(reader, file);                                                                \
-        break;
+        stats.start_phase("print");
+        print_entries<handler>(
+            entries, entries + packed_size, code_ptr, code_length, output,
+            options.threshold, options.top, nullptr, analysis.threads
+        );
+        stats.end_phase();
+        return;
+    }
+
+    // The profile keeps all entries in the printing order,
+    // so they are printed from the same order.
+    stats.start_phase("save_profile");
+    sort_entries(entries, entries + packed_size, analysis.threads);
+    save_profile(
+        analysis.save_profile, entries, packed_size, code_ptr, analysis.max_length, input_hash
+    );
 
-        uint8_t opcode = reader.next_code_byte();
+    stats.start_phase("print");
+    print_entry_range<handler>(
+        first_printed_entry<hashtable_entry>(
+            entries, entries + packed_size, options.threshold, options.top
+        ),
+        entries + packed_size, code_ptr, code_length, output
+    );
+    stats.end_phase();
+}
+
+/**
+ * Only the merged keys that pass the threshold are held in memory,
+ * and with `--top`, only twice as many as are printed.
+ */
+static void merge_inputs(
+    std::vector<std::string> const& profiles, analysis_options const& analysis,
+    report_writer& output, report_options const& options, run_stats& stats
+)
+{
+    stats.start_phase("merge");
+    merged_report report(options.threshold, options.top);
+    merge_profiles(
+        profiles, analysis.save_mergeable,
+        [&report](uint8_t const* key, uint32_t length, uint64_t count)
+        { report.add(key, length, count); }
+    );
+    report.finish();
 
-        switch (opcode)
+    stats.start_phase("print");
+    print_entry_range<handler>(
+        report.entries.data(), report.entries.data() + report.entries.size(),
+        report.key_bytes.data(), report.key_bytes.size(), output
+    );
+    stats.end_phase();
+}
+
+static void read_input_list(char const* list_file, std::vector<std::string>& inputs)
+{
+    FILE* f = fopen(list_file, "r");
+    if (f == nullptr)
+    {
+        failure("Failed to open input list: %s", list_file);
+    }
+    std::string line;
+    for (int c = fgetc(f);; c = fgetc(f))
+    {
+        if (c == '\n' || c == EOF)
+        {
+            if (!line.empty())
+            {
+                inputs.push_back(line);
+            }
+            line.clear();
+            if (c == EOF)
+            {
+                break;
+            }
+        }
+        else
         {
-            CASE(add)
-            CASE(sub)
-            CASE(mul)
-            CASE(div)
-            CASE(rem)
-            CASE(lt)
-            CASE(leq)
-            CASE(gt)
-            CASE(geq)
-            CASE(eq)
-            CASE(neq)
-            CASE(and)
-            CASE(or)
-            CASE(const)
-            CASE(string)
-            CASE(sexp)
-            CASE(sta)
-            CASE(jmp)
-            CASE(end)
-            CASE(ret)
-            CASE(drop)
-            CASE(dup)
-            CASE(swap)
-            CASE(elem)
-            CASE(ld_global)
-            CASE(ld_local)
-            CASE(ld_arg)
-            CASE(ld_capture)
-            CASE(st_global)
-            CASE(st_local)
-            CASE(st_arg)
-            CASE(st_capture)
-            CASE(cjmp_z)
-            CASE(cjmp_nz)
-            CASE(begin)
-            CASE(beginc)
-            CASE(closure)
-            CASE(callc)
-            CASE(call)
-            CASE(tag)
-            CASE(array)
-            CASE(fail)
-            CASE(line)
-            CASE(pattern_strcmp)
-            CASE(pattern_string)
-            CASE(pattern_array)
-            CASE(pattern_sexp)
-            CASE(pattern_boxed)
-            CASE(pattern_unboxed)
-            CASE(pattern_closure)
-            CASE(builtin_read)
-            CASE(builtin_write)
-            CASE(builtin_length)
-            CASE(builtin_string)
-            CASE(builtin_array)
-        default:
-            failure("Unknown instruction 0x%02X at offset %zu", opcode, reader.ip - 1);
-            break;
+            line += static_cast<char>(c);
         }
     }
-};
+    fclose(f);
+}
 
 int main(int argc, char* argv[])
 {
-    uint32_t output_threshold = 1;
-    char* input_file = nullptr;
+    analysis_options analysis;
+    report_options options;
+    output_format format = output_format::text;
+    std::vector<std::string> inputs;
+    std::vector<std::string> merged_profiles;
+    bool is_batch = false;
+    bool is_stats = false;
 
     for (int i = 1; i < argc;)
     {
         std::string arg = argv[i];
         if (arg == "--threshold")
         {
-            output_threshold = std::stoul(argv[i + 1]);
+            options.threshold = std::stoul(argv[i + 1]);
+            i += 2;
+        }
+        else if (arg == "--top")
+        {
+            options.top = std::stoull(argv[i + 1]);
+            i += 2;
+        }
+        else if (arg == "--format")
+        {
+            std::string name = argv[i + 1];
+            if (name == "text")
+            {
+                format = output_format::text;
+            }
+            else if (name == "tsv")
+            {
+                format = output_format::tsv;
+            }
+            else if (name == "json")
+            {
+                format = output_format::json;
+            }
+            else if (name == "binary")
+            {
+                format = output_format::binary;
+            }
+            else
+            {
+                failure("Unknown output format: %s", argv[i + 1]);
+            }
+            i += 2;
+        }
+        else if (arg == "--threads")
+        {
+            analysis.threads = std::stoul(argv[i + 1]);
+            i += 2;
+        }
+        else if (arg == "--memory-limit")
+        {
+            analysis.memory_limit = parse_size(argv[i + 1]);
+            i += 2;
+        }
+        else if (arg == "--mode")
+        {
+            std::string name = argv[i + 1];
+            if (name == "exact")
+            {
+                analysis.mode = analysis_mode::exact;
+            }
+            else if (name == "opcodes")
+            {
+                analysis.mode = analysis_mode::opcodes;
+            }
+            else
+            {
+                failure("Unknown mode: %s", argv[i + 1]);
+            }
             i += 2;
         }
+        else if (arg == "--max-length")
+        {
+            analysis.max_length = std::stoul(argv[i + 1]);
+            if (analysis.max_length < 1 || analysis.max_length > max_sequence_length)
+            {
+                failure("--max-length must be between 1 and %u", max_sequence_length);
+            }
+            i += 2;
+        }
+        else if (arg == "--save-profile")
+        {
+            analysis.save_profile = argv[i + 1];
+            i += 2;
+        }
+        else if (arg == "--load-profile")
+        {
+            analysis.load_profile = argv[i + 1];
+            i += 2;
+        }
+        else if (arg == "--save-mergeable")
+        {
+            analysis.save_mergeable = argv[i + 1];
+            i += 2;
+        }
+        else if (arg == "--merge")
+        {
+            for (++i; i < argc && strncmp(argv[i], "--", 2) != 0; ++i)
+            {
+                merged_profiles.push_back(argv[i]);
+            }
+        }
+        else if (arg == "--prefault")
+        {
+            analysis.prefault = true;
+            ++i;
+        }
+        else if (arg == "--pair-ids")
+        {
+            analysis.pair_ids = true;
+            ++i;
+        }
+        else if (arg == "--stats")
+        {
+            is_stats = true;
+            ++i;
+        }
         else if (arg == "--input")
         {
-            input_file = argv[i + 1];
+            inputs.push_back(argv[i + 1]);
+            i += 2;
+        }
+        else if (arg == "--inputs")
+        {
+            is_batch = true;
+            for (++i; i < argc && strncmp(argv[i], "--", 2) != 0; ++i)
+            {
+                inputs.push_back(argv[i]);
+            }
+        }
+        else if (arg == "--input-list")
+        {
+            is_batch = true;
+            read_input_list(argv[i + 1], inputs);
             i += 2;
         }
         else
@@ -249,29 +575,63 @@ int main(int argc, char* argv[])
         }
     }
 
-    if (input_file == nullptr)
+    if (!merged_profiles.empty() && (!inputs.empty() || analysis.load_profile != nullptr ||
+                                     analysis.save_profile != nullptr))
+    {
+        failure("--merge only merges mergeable profiles, without any other input");
+    }
+    if (analysis.save_mergeable != nullptr && analysis.mode != analysis_mode::exact)
+    {
+        failure("Mergeable profiles are only saved for the exact analysis");
+    }
+    if (analysis.pair_ids && (analysis.mode != analysis_mode::exact || analysis.max_length > 2))
+    {
+        failure("--pair-ids is only for the exact analysis with --max-length up to 2");
+    }
+    if (inputs.empty() && merged_profiles.empty() && analysis.load_profile == nullptr)
     {
         failure("--input file not specified");
     }
-
-    FILE* f = fopen(input_file, "rb");
-    if (f == nullptr)
+    if ((analysis.save_profile != nullptr || analysis.load_profile != nullptr) &&
+        (is_batch || inputs.size() > 1 || analysis.mode != analysis_mode::exact))
     {
-        failure("Failed to open input file: %s", input_file);
+        failure("Profiles are only saved for the exact analysis of a single input");
     }
-    bytefile bf = read_file(f);
-    fclose(f);
-
-    uint32_t max_entries = bf.code_length / 5 + 256 + bf.code_length / 3 + 65536;
-    analyzer<handler> analyzer(bf.code_ptr, bf.code_length, max_entries);
-
-    for (uint32_t i = 0; i < bf.public_symbols_number; ++i)
+    if (analysis.threads == 0)
     {
-        uint8_t* symbol_ptr = &bf.public_area_ptr[i * 2 * sizeof(uint32_t) + sizeof(uint32_t)];
-        uint32_t symbol_offset = le_bytes_to_uint32_t(symbol_ptr);
-        analyzer.find_reachable(symbol_offset);
+        analysis.threads = 1;
     }
 
-    analyzer.count_occurrences();
-    analyzer.print_hashtable(output_threshold);
+    run_stats stats;
+    if (is_stats)
+    {
+        stats.count_tlb_misses();
+    }
+    {
+        report_writer output(stdout, format);
+        if (!merged_profiles.empty())
+        {
+            merge_inputs(merged_profiles, analysis, output, options, stats);
+        }
+        else if (inputs.empty())
+        {
+            stats.start_phase("load_profile");
+            profile loaded = load_profile(analysis.load_profile);
+            stats.start_phase("print");
+            print_profile(loaded, output, options);
+            stats.end_phase();
+        }
+        else if (is_batch || inputs.size() > 1)
+        {
+            analyze_corpus(inputs, analysis, output, options, stats);
+        }
+        else
+        {
+            analyze_file(inputs[0].c_str(), analysis, output, options, stats);
+        }
+    }
+    if (is_stats)
+    {
+        stats.write(stderr);
+    }
 }
@@ -0,0 +1,105 @@
+#include "memory.hpp"
+#include "assertions.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+void mapping_deleter::operator()(void const* memory) const
+{
+    munmap(const_cast<void*>(memory), size);
+}
+
+static void* map_anonymous(size_t size, int flags)
+{
+    return mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+}
+
+/**
+ * Huge pages need the mapping to be aligned to them, which `mmap` doesn't promise,
+ * so a huge page more is mapped and the unaligned ends are unmapped.
+ */
+void* map_zeroed(size_t size, size_t& mapped_size)
+{
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    if (size < huge_page_size)
+    {
+        mapped_size = std::max(page_size, (size + page_size - 1) / page_size * page_size);
+        void* memory = map_anonymous(mapped_size, 0);
+        if (memory == MAP_FAILED)
+        {
+            failure("Unable to allocate %zu bytes of memory", size);
+        }
+        return memory;
+    }
+
+    mapped_size = (size + huge_page_size - 1) / huge_page_size * huge_page_size;
+#ifdef HUGETLB_PAGES
+    void* reserved = map_anonymous(mapped_size, MAP_HUGETLB);
+    if (reserved != MAP_FAILED)
+    {
+        return reserved;
+    }
+#endif
+    uint8_t* memory = static_cast<uint8_t*>(map_anonymous(mapped_size + huge_page_size, 0));
+    if (memory == MAP_FAILED)
+    {
+        failure("Unable to allocate %zu bytes of memory", size);
+    }
+    uintptr_t address = reinterpret_cast<uintptr_t>(memory);
+    size_t head = (huge_page_size - address % huge_page_size) % huge_page_size;
+    if (head != 0)
+    {
+        munmap(memory, head);
+    }
+    munmap(memory + head + mapped_size, huge_page_size - head);
+    memory += head;
+    madvise(memory, mapped_size, MADV_HUGEPAGE);
+    return memory;
+}
+
+void release_pages(void* memory, size_t size)
+{
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    uintptr_t address = reinterpret_cast<uintptr_t>(memory);
+    uintptr_t begin = (address + page_size - 1) / page_size * page_size;
+    uintptr_t end = (address + size) / page_size * page_size;
+    if (begin < end)
+    {
+        madvise(reinterpret_cast<void*>(begin), end - begin, MADV_DONTNEED);
+    }
+}
+
+/**
+ * Adding zero writes a page without changing it, so the pages
+ * that are already in use are left as they are.
+ */
+void prefault(void* memory, size_t size, unsigned threads)
+{
+    uint8_t* bytes = static_cast<uint8_t*>(memory);
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t pages = (size + page_size - 1) / page_size;
+    threads = std::max(threads, 1u);
+
+    auto touch = [bytes, page_size, pages, threads](unsigned thread)
+    {
+        for (size_t page = pages * thread / threads; page < pages * (thread + 1) / threads; ++page)
+        {
+            __atomic_fetch_add(bytes + page * page_size, 0, __ATOMIC_RELAXED);
+        }
+    };
+    std::vector<std::thread> workers;
+    for (unsigned i = 1; i < threads; ++i)
+    {
+        workers.emplace_back(touch, i);
+    }
+    touch(0);
+    for (std::thread& worker : workers)
+    {
+        worker.join();
+    }
+}
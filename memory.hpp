@@ -0,0 +1,64 @@
+#ifndef MEMORY_HPP
+#define MEMORY_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+
+/**
+ * The large arrays of the analysis (the hashtables, the bitsets and the opcode counters)
+ * come from their own anonymous mappings instead of the heap.
+ *
+ * A fresh mapping reads as zeros, and the kernel zeroes a page only when it is first touched,
+ * so an array is zeroed without a pass over it, and the untouched part costs nothing.
+ * Arrays of at least `huge_page_size` are aligned to it and backed by transparent huge pages,
+ * which cuts the TLB misses of random probing. Built with `HUGETLB_PAGES`,
+ * they are taken from the reserved huge pages first.
+ */
+constexpr size_t huge_page_size = size_t(2) << 20;
+
+/**
+ * Unmaps the memory of `allocate_zeroed`.
+ */
+struct mapping_deleter
+{
+    size_t size = 0;
+
+    void operator()(void const* memory) const;
+};
+
+template <typename T>
+using mapped_array = std::unique_ptr<T[], mapping_deleter>;
+
+/**
+ * Maps at least `size` bytes of zeros. Fails if the memory can't be mapped.
+ */
+void* map_zeroed(size_t size, size_t& mapped_size);
+
+/**
+ * `T` has to be valid as all zero bytes, as integers, atomics of them
+ * and the hashtable entries are.
+ */
+template <typename T>
+mapped_array<T> allocate_zeroed(size_t count)
+{
+    static_assert(std::is_trivially_destructible<T>::value);
+    size_t mapped_size;
+    void* memory = map_zeroed(count * sizeof(T), mapped_size);
+    return mapped_array<T>(static_cast<T*>(memory), mapping_deleter{mapped_size});
+}
+
+/**
+ * Gives the whole pages within [memory, memory + size) back to the kernel.
+ * They take no memory until they are touched again, and then read as zeros.
+ */
+void release_pages(void* memory, size_t size);
+
+/**
+ * Touches every page of [memory, memory + size) with `threads` threads,
+ * so that the page faults are taken in parallel up front instead of during the analysis.
+ */
+void prefault(void* memory, size_t size, unsigned threads);
+
+#endif
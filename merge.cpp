@@ -0,0 +1,359 @@
+#include "merge.hpp"
+#include "assertions.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <queue>
+
+static void put_le_uint32_t(uint8_t* bytes, uint32_t value)
+{
+    for (int i = 0; i < 4; ++i)
+    {
+        bytes[i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+}
+
+int compare_keys(uint8_t const* a, uint32_t a_length, uint8_t const* b, uint32_t b_length)
+{
+    int order = memcmp(a, b, std::min(a_length, b_length));
+    if (order != 0)
+    {
+        return order;
+    }
+    return a_length < b_length ? -1 : a_length > b_length;
+}
+
+mergeable_writer::mergeable_writer(char const* path, unsigned max_length)
+    : file(fopen(path, "wb")), path(path), buffer(new uint8_t[buffer_capacity])
+{
+    if (file == nullptr)
+    {
+        failure("Failed to open mergeable profile for writing: %s", path);
+    }
+    memcpy(buffer.get(), mergeable_magic, sizeof(mergeable_magic));
+    put_le_uint32_t(buffer.get() + sizeof(mergeable_magic), mergeable_version);
+    put_le_uint32_t(buffer.get() + sizeof(mergeable_magic) + 4, max_length);
+    buffer_size = sizeof(mergeable_magic) + 8;
+}
+
+mergeable_writer::~mergeable_writer()
+{
+    flush();
+    if (fclose(file) != 0)
+    {
+        failure("Failed to write mergeable profile: %s", path);
+    }
+}
+
+/**
+ * The records are formatted into the buffer directly,
+ * since a couple of `fwrite` calls per key would cost more than the sorting.
+ */
+void mergeable_writer::add(uint8_t const* key, uint32_t length, uint64_t count)
+{
+    if (buffer_size + record_header_size + length > buffer_capacity)
+    {
+        flush();
+    }
+    uint8_t* record = buffer.get() + buffer_size;
+    put_le_uint32_t(record, length);
+    put_le_uint32_t(record + 4, static_cast<uint32_t>(count));
+    put_le_uint32_t(record + 8, static_cast<uint32_t>(count >> 32));
+    buffer_size += record_header_size;
+    if (record_header_size + length > buffer_capacity)
+    {
+        flush();
+        if (fwrite(key, 1, length, file) != length)
+        {
+            failure("Failed to write mergeable profile: %s", path);
+        }
+        return;
+    }
+    memcpy(buffer.get() + buffer_size, key, length);
+    buffer_size += length;
+}
+
+void mergeable_writer::flush()
+{
+    if (fwrite(buffer.get(), 1, buffer_size, file) != buffer_size)
+    {
+        failure("Failed to write mergeable profile: %s", path);
+    }
+    buffer_size = 0;
+}
+
+/**
+ * The keys are far apart in the code, so they are sorted by their first 8 bytes,
+ * kept next to the entries, and compared in full only when those are equal.
+ */
+void save_mergeable(
+    char const* path, hashtable_entry const* entries, offset_t count, uint8_t const* code_ptr,
+    unsigned max_length
+)
+{
+    struct sorted_entry
+    {
+        uint64_t prefix;
+        hashtable_entry entry;
+    };
+    std::vector<sorted_entry> sorted(count);
+    for (offset_t i = 0; i < count; ++i)
+    {
+        uint8_t prefix_bytes[8] = {};
+        memcpy(
+            prefix_bytes, code_ptr + entries[i].key.ip, std::min<uint32_t>(8, entries[i].key.length)
+        );
+        uint64_t prefix = 0;
+        for (uint8_t byte : prefix_bytes)
+        {
+            prefix = prefix << 8 | byte;
+        }
+        sorted[i] = {prefix, entries[i]};
+    }
+    std::sort(
+        sorted.begin(), sorted.end(),
+        [code_ptr](sorted_entry const& a, sorted_entry const& b)
+        {
+            if (a.prefix != b.prefix)
+            {
+                return a.prefix < b.prefix;
+            }
+            return compare_keys(
+                       code_ptr + a.entry.key.ip, a.entry.key.length, code_ptr + b.entry.key.ip,
+                       b.entry.key.length
+                   ) < 0;
+        }
+    );
+
+    mergeable_writer writer(path, max_length);
+    for (sorted_entry const& it : sorted)
+    {
+        writer.add(code_ptr + it.entry.key.ip, it.entry.key.length, it.entry.value);
+    }
+}
+
+/**
+ * Reads the records of a single profile one at a time
+ * and checks that they are sorted.
+ */
+struct mergeable_reader
+{
+    std::string path;
+    FILE* file;
+    std::unique_ptr<char[]> buffer;
+    unsigned max_length;
+
+    std::vector<uint8_t> key;
+    uint64_t count = 0;
+
+    explicit mergeable_reader(std::string const& path)
+        : path(path), file(fopen(path.c_str(), "rb")), buffer(new char[buffer_size])
+    {
+        if (file == nullptr)
+        {
+            failure("Failed to open mergeable profile: %s", path.c_str());
+        }
+        setvbuf(file, buffer.get(), _IOFBF, buffer_size);
+
+        uint8_t header[sizeof(mergeable_magic) + 8];
+        if (fread(header, 1, sizeof(header), file) != sizeof(header) ||
+            memcmp(header, mergeable_magic, sizeof(mergeable_magic)) != 0)
+        {
+            failure("Not a mergeable profile: %s", path.c_str());
+        }
+        uint32_t version = le_bytes_to_uint32_t(header + sizeof(mergeable_magic));
+        if (version != mergeable_version)
+        {
+            failure("Unsupported mergeable profile version %u: %s", version, path.c_str());
+        }
+        max_length = le_bytes_to_uint32_t(header + sizeof(mergeable_magic) + 4);
+    }
+
+    mergeable_reader(mergeable_reader const&) = delete;
+
+    mergeable_reader& operator=(mergeable_reader const&) = delete;
+
+    ~mergeable_reader()
+    {
+        fclose(file);
+    }
+
+    /**
+     * Returns false at the end of the profile.
+     */
+    bool next()
+    {
+        uint8_t record[record_header_size];
+        size_t read = fread(record, 1, sizeof(record), file);
+        if (read == 0 && feof(file))
+        {
+            return false;
+        }
+        if (read != sizeof(record))
+        {
+            failure("Mergeable profile is truncated: %s", path.c_str());
+        }
+        uint32_t length = le_bytes_to_uint32_t(record);
+        count = le_bytes_to_uint32_t(record + 4) |
+                static_cast<uint64_t>(le_bytes_to_uint32_t(record + 8)) << 32;
+
+        previous.swap(key);
+        key.resize(length);
+        if (fread(key.data(), 1, length, file) != length)
+        {
+            failure("Mergeable profile is truncated: %s", path.c_str());
+        }
+        if (!is_first && compare_keys(previous.data(), previous.size(), key.data(), length) >= 0)
+        {
+            failure("Mergeable profile is not sorted: %s", path.c_str());
+        }
+        is_first = false;
+        return true;
+    }
+
+  private:
+    static constexpr size_t buffer_size = 1 << 16;
+
+    std::vector<uint8_t> previous;
+    bool is_first = true;
+};
+
+/**
+ * A heap of the readers by their current keys
+ * gives the smallest key of all of them.
+ */
+void merge_profiles(
+    std::vector<std::string> const& paths, char const* output,
+    std::function<void(uint8_t const* key, uint32_t length, uint64_t count)> const& merged
+)
+{
+    std::vector<std::unique_ptr<mergeable_reader>> readers;
+    for (std::string const& path : paths)
+    {
+        readers.emplace_back(new mergeable_reader(path));
+        if (readers.back()->max_length != readers.front()->max_length)
+        {
+            failure(
+                "%s is saved with --max-length %u, %s with %u", path.c_str(),
+                readers.back()->max_length, paths.front().c_str(), readers.front()->max_length
+            );
+        }
+    }
+
+    auto is_after = [&readers](size_t a, size_t b)
+    {
+        std::vector<uint8_t> const& a_key = readers[a]->key;
+        std::vector<uint8_t> const& b_key = readers[b]->key;
+        return compare_keys(a_key.data(), a_key.size(), b_key.data(), b_key.size()) > 0;
+    };
+    std::priority_queue<size_t, std::vector<size_t>, decltype(is_after)> heap(is_after);
+    for (size_t i = 0; i < readers.size(); ++i)
+    {
+        if (readers[i]->next())
+        {
+            heap.push(i);
+        }
+    }
+
+    std::unique_ptr<mergeable_writer> writer;
+    if (output != nullptr)
+    {
+        writer.reset(new mergeable_writer(output, readers.front()->max_length));
+    }
+
+    std::vector<uint8_t> key;
+    while (!heap.empty())
+    {
+        size_t first = heap.top();
+        heap.pop();
+        key = readers[first]->key;
+        uint64_t count = readers[first]->count;
+        if (readers[first]->next())
+        {
+            heap.push(first);
+        }
+
+        while (!heap.empty())
+        {
+            mergeable_reader& reader = *readers[heap.top()];
+            if (compare_keys(key.data(), key.size(), reader.key.data(), reader.key.size()) != 0)
+            {
+                break;
+            }
+            if (__builtin_add_overflow(count, reader.count, &count))
+            {
+                failure("A merged count doesn't fit into 64 bits");
+            }
+            size_t same = heap.top();
+            heap.pop();
+            if (reader.next())
+            {
+                heap.push(same);
+            }
+        }
+        if (writer != nullptr)
+        {
+            writer->add(key.data(), key.size(), count);
+        }
+        merged(key.data(), key.size(), count);
+    }
+}
+
+merged_report::merged_report(uint64_t threshold, offset_t top) : threshold(threshold), top(top)
+{
+}
+
+void merged_report::add(uint8_t const* key, uint32_t length, uint64_t count)
+{
+    if (count < threshold)
+    {
+        return;
+    }
+    if (key_bytes.size() + length > std::numeric_limits<offset_t>::max())
+    {
+        failure("The merged keys don't fit into offsets, rebuild with WIDE_OFFSETS");
+    }
+    entries.push_back({{key_bytes.size(), length}, count});
+    key_bytes.insert(key_bytes.end(), key, key + length);
+    if (top != no_limit && entries.size() > 2 * static_cast<uint64_t>(top))
+    {
+        keep_top();
+    }
+}
+
+/**
+ * The kept keys are copied in their old order, so the order of the offsets
+ * stays the order of the keys, and the ties are broken the same way.
+ */
+void merged_report::keep_top()
+{
+    auto kept_begin = entries.end() - std::min<uint64_t>(top, entries.size());
+    std::nth_element(entries.begin(), kept_begin, entries.end());
+    entries.erase(entries.begin(), kept_begin);
+    std::sort(
+        entries.begin(), entries.end(),
+        [](merged_entry const& a, merged_entry const& b) { return a.key.ip < b.key.ip; }
+    );
+
+    std::vector<uint8_t> kept_bytes;
+    for (merged_entry& entry : entries)
+    {
+        uint64_t ip = kept_bytes.size();
+        kept_bytes.insert(
+            kept_bytes.end(), key_bytes.begin() + entry.key.ip,
+            key_bytes.begin() + entry.key.ip + entry.key.length
+        );
+        entry.key.ip = ip;
+    }
+    key_bytes.swap(kept_bytes);
+}
+
+void merged_report::finish()
+{
+    if (top != no_limit && entries.size() > top)
+    {
+        keep_top();
+    }
+    std::sort(entries.begin(), entries.end());
+}
@@ -0,0 +1,131 @@
+#ifndef MERGE_HPP
+#define MERGE_HPP
+
+#include "analyzer.hpp"
+#include "bytefile.hpp"
+#include "profile.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * Counts of separately analyzed inputs (say, modules on different machines)
+ * that can be combined without losing anything.
+ *
+ * A mergeable profile is a header followed by a record for every key,
+ * in the order of the key bytes, up to the end of the file.
+ * A record is a little-endian 4-byte key length, an 8-byte count and the key bytes.
+ * The counts are 64-bit, so the sums over large corpora don't overflow.
+ * Since the keys are sorted, any number of profiles is merged
+ * by reading each of them once, holding a single record of each.
+ */
+constexpr char mergeable_magic[8] = {'L', 'A', 'M', 'A', 'M', 'E', 'R', 'G'};
+constexpr uint32_t mergeable_version = 1;
+constexpr size_t record_header_size = 12;
+
+/**
+ * Orders keys by their bytes, a prefix before the longer keys.
+ */
+int compare_keys(uint8_t const* a, uint32_t a_length, uint8_t const* b, uint32_t b_length);
+
+/**
+ * Writes the records, which have to come in the order of their keys.
+ */
+struct mergeable_writer
+{
+    mergeable_writer(char const* path, unsigned max_length);
+
+    mergeable_writer(mergeable_writer const&) = delete;
+
+    mergeable_writer& operator=(mergeable_writer const&) = delete;
+
+    ~mergeable_writer();
+
+    void add(uint8_t const* key, uint32_t length, uint64_t count);
+
+  private:
+    static constexpr size_t buffer_capacity = 1 << 20;
+
+    FILE* file;
+    char const* path;
+    std::unique_ptr<uint8_t[]> buffer;
+    size_t buffer_size = 0;
+
+    void flush();
+};
+
+/**
+ * Saves the packed entries in the order of their keys, read from `code_ptr`.
+ */
+void save_mergeable(
+    char const* path, hashtable_entry const* entries, offset_t count, uint8_t const* code_ptr,
+    unsigned max_length
+);
+
+/**
+ * Calls `merged` with every distinct key of the profiles and its total count,
+ * in the order of the keys. The key bytes are only valid during the call.
+ * The profiles have to be saved with the same `--max-length`.
+ * Unless `output` is null, the merged profile is also saved there.
+ */
+void merge_profiles(
+    std::vector<std::string> const& paths, char const* output,
+    std::function<void(uint8_t const* key, uint32_t length, uint64_t count)> const& merged
+);
+
+struct merged_entry
+{
+    profile_key key;
+    uint64_t value;
+
+    /**
+     * Entries with equal counts are ordered by their keys.
+     */
+    bool operator<(merged_entry const& other) const
+    {
+        if (value != other.value)
+        {
+            return value < other.value;
+        }
+        return key.ip < other.key.ip;
+    }
+};
+
+/**
+ * The merged keys that are going to be printed.
+ * The threshold is applied to the total counts,
+ * and with `top`, at most `2 * top` keys are kept at once.
+ */
+struct merged_report
+{
+    uint64_t threshold;
+    offset_t top;
+
+    /**
+     * The keys of `entries`, in the order of the keys.
+     */
+    std::vector<uint8_t> key_bytes;
+    std::vector<merged_entry> entries;
+
+    merged_report(uint64_t threshold, offset_t top);
+
+    void add(uint8_t const* key, uint32_t length, uint64_t count);
+
+    /**
+     * Leaves only the printed entries, in the order they are printed in.
+     */
+    void finish();
+
+  private:
+    /**
+     * Keeps the `top` most frequent entries and drops the bytes of the other ones.
+     */
+    void keep_top();
+};
+
+#endif
@@ -0,0 +1,179 @@
+#include "profile.hpp"
+#include "assertions.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <new>
+#include <vector>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+constexpr uint64_t content_hash_multiplier = 0x517CC1B727220A95;
+
+static void update_content_hash(uint64_t& hash, uint64_t word)
+{
+    hash = (((hash << 5) | (hash >> 59)) ^ word) * content_hash_multiplier;
+}
+
+/**
+ * Eight bytes at a time, so that hashing a large input
+ * costs little next to reading it.
+ */
+uint64_t content_hash(bytefile const& bytefile)
+{
+    uint8_t const* begin = bytefile.public_area_ptr;
+    size_t length = bytefile.code_ptr + bytefile.code_length - begin;
+
+    uint64_t hash = 0;
+    update_content_hash(hash, bytefile.public_symbols_number);
+    update_content_hash(hash, bytefile.stringtab_size);
+    update_content_hash(hash, length);
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, begin + i, 8);
+        update_content_hash(hash, word);
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, begin + i, length - i);
+    update_content_hash(hash, tail);
+    return hash ^ (hash >> 32);
+}
+
+static void write_bytes(FILE* f, void const* bytes, size_t size, char const* path)
+{
+    if (fwrite(bytes, 1, size, f) != size)
+    {
+        failure("Failed to write profile: %s", path);
+    }
+}
+
+/**
+ * The keys are written in the order of the entries,
+ * so their offsets grow along with the entries.
+ */
+void save_profile(
+    char const* path, hashtable_entry const* entries, offset_t count, uint8_t const* code_ptr,
+    unsigned max_length, uint64_t input_hash
+)
+{
+    FILE* f = fopen(path, "wb");
+    if (f == nullptr)
+    {
+        failure("Failed to open profile for writing: %s", path);
+    }
+    std::unique_ptr<char[]> buffer(new char[1 << 20]);
+    setvbuf(f, buffer.get(), _IOFBF, 1 << 20);
+
+    profile_header header{};
+    memcpy(header.magic, profile_magic, sizeof(profile_magic));
+    header.version = profile_version;
+    header.max_length = max_length;
+    header.input_hash = input_hash;
+    header.entry_count = count;
+    for (offset_t i = 0; i < count; ++i)
+    {
+        header.key_bytes_size += entries[i].key.length;
+    }
+    write_bytes(f, &header, sizeof(header), path);
+
+    uint64_t ip = 0;
+    for (offset_t i = 0; i < count; ++i)
+    {
+        profile_entry entry{{ip, entries[i].key.length}, entries[i].value};
+        write_bytes(f, &entry, sizeof(entry), path);
+        ip += entries[i].key.length;
+    }
+    for (offset_t i = 0; i < count; ++i)
+    {
+        write_bytes(f, code_ptr + entries[i].key.ip, entries[i].key.length, path);
+    }
+
+    if (fclose(f) != 0)
+    {
+        failure("Failed to write profile: %s", path);
+    }
+}
+
+static std::unique_ptr<uint8_t[], content_deleter> read_content(FILE* f, size_t& size)
+{
+    struct stat file_stat;
+    if (fstat(fileno(f), &file_stat) == 0 && S_ISREG(file_stat.st_mode) && file_stat.st_size > 0)
+    {
+        size = file_stat.st_size;
+        void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+        if (mapping != MAP_FAILED)
+        {
+            return std::unique_ptr<uint8_t[], content_deleter>(
+                static_cast<uint8_t*>(mapping), content_deleter{size}
+            );
+        }
+    }
+
+    std::vector<uint8_t> bytes;
+    uint8_t chunk[1 << 16];
+    for (size_t read; (read = fread(chunk, 1, sizeof(chunk), f)) > 0;)
+    {
+        bytes.insert(bytes.end(), chunk, chunk + read);
+    }
+    if (ferror(f))
+    {
+        failure("Unable to read profile. Reason: %s", strerror(errno));
+    }
+    size = bytes.size();
+    std::unique_ptr<uint8_t[], content_deleter> content(new uint8_t[size]);
+    memcpy(content.get(), bytes.data(), size);
+    return content;
+}
+
+/**
+ * Only the sizes are checked here. The offsets of the keys
+ * are checked when the entries are printed.
+ */
+profile load_profile(char const* path)
+{
+    FILE* f = fopen(path, "rb");
+    if (f == nullptr)
+    {
+        failure("Failed to open profile: %s", path);
+    }
+    size_t size;
+    profile result;
+    result.content = read_content(f, size);
+    fclose(f);
+
+    if (size < sizeof(profile_header))
+    {
+        failure("Profile is too small for the header: %s", path);
+    }
+    result.header = reinterpret_cast<profile_header const*>(result.content.get());
+    profile_header const& header = *result.header;
+    if (memcmp(header.magic, profile_magic, sizeof(profile_magic)) != 0)
+    {
+        failure("Not a profile: %s", path);
+    }
+    if (header.version != profile_version)
+    {
+        failure("Unsupported profile version %u: %s", header.version, path);
+    }
+    uint64_t entries_size = size - sizeof(profile_header);
+    if (header.entry_count > entries_size / sizeof(profile_entry) ||
+        header.key_bytes_size != entries_size - header.entry_count * sizeof(profile_entry))
+    {
+        failure("Profile is truncated: %s", path);
+    }
+    if (header.key_bytes_size > std::numeric_limits<offset_t>::max())
+    {
+        failure("Profile keys are larger than 4 GB, rebuild with WIDE_OFFSETS");
+    }
+
+    result.entries =
+        reinterpret_cast<profile_entry const*>(result.content.get() + sizeof(profile_header));
+    result.key_bytes = result.content.get() + sizeof(profile_header) +
+                       header.entry_count * sizeof(profile_entry);
+    return result;
+}
@@ -0,0 +1,87 @@
+#ifndef PROFILE_HPP
+#define PROFILE_HPP
+
+#include "analyzer.hpp"
+#include "bytefile.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+/**
+ * A saved analysis, so that it can be reported again
+ * with other `--threshold`, `--top` or `--format` without counting.
+ *
+ * The file is the header, the entries sorted in the order they are printed in,
+ * and the bytes of all keys. Everything is little-endian and naturally aligned,
+ * so the loaded file is used right where it is mapped,
+ * and finding the printed entries is a binary search.
+ */
+constexpr char profile_magic[8] = {'L', 'A', 'M', 'A', 'P', 'R', 'O', 'F'};
+constexpr uint32_t profile_version = 1;
+
+struct profile_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t max_length;
+
+    /**
+     * `content_hash` of the analyzed file.
+     */
+    uint64_t input_hash;
+
+    uint64_t entry_count;
+    uint64_t key_bytes_size;
+};
+
+#pragma pack(push, 4)
+
+struct profile_key
+{
+    /**
+     * The offset of the key in the key bytes.
+     */
+    uint64_t ip;
+    uint32_t length;
+};
+
+/**
+ * Mirrors `hashtable_entry`, so that it is printed the same way.
+ */
+struct profile_entry
+{
+    profile_key key;
+    uint32_t value;
+};
+
+#pragma pack(pop)
+
+struct profile
+{
+    std::unique_ptr<uint8_t[], content_deleter> content;
+    profile_header const* header;
+    profile_entry const* entries;
+    uint8_t* key_bytes;
+};
+
+/**
+ * A 64-bit hash of the whole analyzed content of the file:
+ * the public symbols, the strings and the code.
+ */
+uint64_t content_hash(bytefile const& bytefile);
+
+/**
+ * Saves the packed entries, which have to be sorted, with their keys read from `code_ptr`.
+ */
+void save_profile(
+    char const* path, hashtable_entry const* entries, offset_t count, uint8_t const* code_ptr,
+    unsigned max_length, uint64_t input_hash
+);
+
+/**
+ * Maps the profile into memory if possible, reads it otherwise.
+ */
+profile load_profile(char const* path);
+
+#endif
@@ -0,0 +1,234 @@
+#include "report.hpp"
+#include "assertions.hpp"
+
+#include <cstring>
+
+report_writer::report_writer(FILE* file, output_format format)
+    : file(file), format(format), buffer(new char[buffer_capacity])
+{
+}
+
+report_writer::~report_writer()
+{
+    if (format == output_format::json && named_reports != 0)
+    {
+        put("\n]\n", 3);
+    }
+    flush();
+}
+
+void report_writer::begin_report(char const* name, uint64_t entries)
+{
+    is_first_entry = true;
+    is_named = name != nullptr;
+    switch (format)
+    {
+    case output_format::text:
+    case output_format::tsv:
+        if (is_named)
+        {
+            put("# ", 2);
+            put(name, strlen(name));
+            put('\n');
+        }
+        break;
+    case output_format::json:
+        if (is_named)
+        {
+            put(named_reports == 0 ? "[\n" : ",\n", 2);
+            put("{\"name\": ", 9);
+            put_json_string(name);
+            put(", \"entries\": ", 13);
+        }
+        put('[');
+        break;
+    case output_format::binary:
+        if (is_named)
+        {
+            put_le_uint32_t(strlen(name));
+            put(name, strlen(name));
+            put_le_uint32_t(static_cast<uint32_t>(entries));
+            put_le_uint32_t(static_cast<uint32_t>(entries >> 32));
+        }
+        break;
+    }
+    named_reports += is_named;
+}
+
+void report_writer::begin_entry(uint64_t count)
+{
+    switch (format)
+    {
+    case output_format::text:
+        put_decimal(count);
+        put(" x", 2);
+        break;
+    case output_format::tsv:
+        put_decimal(count);
+        break;
+    case output_format::json:
+        put(is_first_entry ? "\n{\"count\": " : ",\n{\"count\": ", is_first_entry ? 11 : 12);
+        put_decimal(count);
+        put(", \"instructions\": [", 19);
+        break;
+    case output_format::binary:
+        if (count > UINT32_MAX)
+        {
+            failure("A count doesn't fit into the binary format, use a mergeable profile");
+        }
+        put_le_uint32_t(count);
+        break;
+    }
+    is_first_entry = false;
+    is_first_instruction = true;
+}
+
+void report_writer::key_bytes(uint8_t const* bytes, uint32_t length)
+{
+    put_le_uint32_t(length);
+    put(reinterpret_cast<char const*>(bytes), length);
+}
+
+void report_writer::begin_instruction()
+{
+    switch (format)
+    {
+    case output_format::text:
+        put(' ');
+        break;
+    case output_format::tsv:
+        put('\t');
+        break;
+    case output_format::json:
+        put(is_first_instruction ? "[" : "], [", is_first_instruction ? 1 : 4);
+        break;
+    case output_format::binary:
+        break;
+    }
+    is_first_instruction = false;
+}
+
+void report_writer::mnemonic(char const* name)
+{
+    if (format == output_format::json)
+    {
+        put('"');
+        put(name, strlen(name));
+        put('"');
+    }
+    else
+    {
+        put(name, strlen(name));
+    }
+}
+
+void report_writer::operand(uint32_t value)
+{
+    if (format == output_format::json)
+    {
+        put(", ", 2);
+    }
+    else
+    {
+        put(' ');
+    }
+    put_decimal(value);
+}
+
+void report_writer::end_entry()
+{
+    switch (format)
+    {
+    case output_format::text:
+    case output_format::tsv:
+        put('\n');
+        break;
+    case output_format::json:
+        put(is_first_instruction ? "]}" : "]]}", is_first_instruction ? 2 : 3);
+        break;
+    case output_format::binary:
+        break;
+    }
+}
+
+void report_writer::end_report()
+{
+    if (format == output_format::json)
+    {
+        put(is_named ? "\n]}" : "\n]\n", 3);
+    }
+    flush();
+}
+
+void report_writer::put(char const* data, size_t length)
+{
+    if (buffer_size + length > buffer_capacity)
+    {
+        flush();
+        if (length > buffer_capacity)
+        {
+            if (fwrite(data, 1, length, file) != length)
+            {
+                failure("Unable to write the report");
+            }
+            return;
+        }
+    }
+    memcpy(&buffer[buffer_size], data, length);
+    buffer_size += length;
+}
+
+void report_writer::put_decimal(uint64_t value)
+{
+    char digits[20];
+    size_t length = 0;
+    do
+    {
+        digits[sizeof(digits) - ++length] = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+    put(digits + sizeof(digits) - length, length);
+}
+
+void report_writer::put_le_uint32_t(uint32_t value)
+{
+    char bytes[4] = {
+        static_cast<char>(value), static_cast<char>(value >> 8), static_cast<char>(value >> 16),
+        static_cast<char>(value >> 24)
+    };
+    put(bytes, 4);
+}
+
+void report_writer::put_json_string(char const* text)
+{
+    static char const hex_digits[] = "0123456789abcdef";
+    put('"');
+    for (; *text != '\0'; ++text)
+    {
+        unsigned char c = *text;
+        if (c == '"' || c == '\\')
+        {
+            put('\\');
+            put(c);
+        }
+        else if (c < 0x20)
+        {
+            char escaped[6] = {'\\', 'u', '0', '0', hex_digits[c >> 4], hex_digits[c & 15]};
+            put(escaped, 6);
+        }
+        else
+        {
+            put(c);
+        }
+    }
+    put('"');
+}
+
+void report_writer::flush()
+{
+    if (buffer_size != 0 && fwrite(buffer.get(), 1, buffer_size, file) != buffer_size)
+    {
+        failure("Unable to write the report");
+    }
+    buffer_size = 0;
+}
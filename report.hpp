@@ -0,0 +1,111 @@
+#ifndef REPORT_HPP
+#define REPORT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+
+enum class output_format
+{
+    /**
+     * `<count> x <instruction> <instruction>`,
+     * where an instruction is its mnemonic followed by its operands.
+     */
+    text,
+
+    /**
+     * The count and the instructions separated by tabs.
+     */
+    tsv,
+
+    /**
+     * An array of `{"count": <count>, "instructions": [["<mnemonic>", <operand>, ...], ...]}`.
+     * A named report is `{"name": "<name>", "entries": <array>}`,
+     * and the named reports of one output are the elements of a top-level array.
+     */
+    json,
+
+    /**
+     * Little-endian 4-byte count, 4-byte key length and the key bytes
+     * for every entry, without any decoding.
+     * A named report starts with a 4-byte name length, the name
+     * and an 8-byte number of entries.
+     * Counts over 4 bytes, which only merging produces, are an error.
+     */
+    binary
+};
+
+/**
+ * Formats the report into a large buffer
+ * that is written out only when it is full.
+ */
+struct report_writer
+{
+    report_writer(FILE* file, output_format format);
+
+    report_writer(report_writer const&) = delete;
+
+    report_writer& operator=(report_writer const&) = delete;
+
+    ~report_writer();
+
+    bool wants_key_bytes() const
+    {
+        return format == output_format::binary;
+    }
+
+    /**
+     * A report is named when there are several of them in one output.
+     * Text and TSV reports then start with a `# <name>` line.
+     * The JSON array of the named reports is closed by the destructor.
+     */
+    void begin_report(char const* name = nullptr, uint64_t entries = 0);
+
+    void begin_entry(uint64_t count);
+
+    void key_bytes(uint8_t const* bytes, uint32_t length);
+
+    void begin_instruction();
+
+    void mnemonic(char const* name);
+
+    void operand(uint32_t value);
+
+    void end_entry();
+
+    void end_report();
+
+  private:
+    static constexpr size_t buffer_capacity = 1 << 20;
+
+    FILE* file;
+    output_format format;
+    std::unique_ptr<char[]> buffer;
+    size_t buffer_size = 0;
+    bool is_first_entry = true;
+    bool is_first_instruction = true;
+    bool is_named = false;
+    uint64_t named_reports = 0;
+
+    void put(char const* data, size_t length);
+
+    void put(char c)
+    {
+        if (buffer_size == buffer_capacity)
+        {
+            flush();
+        }
+        buffer[buffer_size++] = c;
+    }
+
+    void put_decimal(uint64_t value);
+
+    void put_le_uint32_t(uint32_t value);
+
+    void put_json_string(char const* text);
+
+    void flush();
+};
+
+#endif
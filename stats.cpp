@@ -0,0 +1,198 @@
+#include "stats.hpp"
+
+#include <cstring>
+
+#include <linux/perf_event.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static uint64_t page_faults()
+{
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_minflt + usage.ru_majflt;
+}
+
+void probe_stats::add(probe_stats const& other)
+{
+    lookups += other.lookups;
+    for (unsigned i = 0; i < buckets; ++i)
+    {
+        probe_lengths[i] += other.probe_lengths[i];
+    }
+    equals_calls += other.equals_calls;
+    equals_mismatches += other.equals_mismatches;
+}
+
+run_stats::~run_stats()
+{
+    if (tlb_misses_fd != -1)
+    {
+        close(tlb_misses_fd);
+    }
+}
+
+/**
+ * Virtual machines often don't expose the hardware counters,
+ * and then the misses are simply not reported.
+ */
+void run_stats::count_tlb_misses()
+{
+    perf_event_attr attributes;
+    memset(&attributes, 0, sizeof(attributes));
+    attributes.size = sizeof(attributes);
+    attributes.type = PERF_TYPE_HW_CACHE;
+    attributes.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                        (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attributes.exclude_kernel = 1;
+    attributes.exclude_hv = 1;
+    attributes.inherit = 1;
+    tlb_misses_fd = syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0);
+}
+
+uint64_t run_stats::tlb_misses() const
+{
+    uint64_t count = 0;
+    if (tlb_misses_fd != -1 && read(tlb_misses_fd, &count, sizeof(count)) != sizeof(count))
+    {
+        count = 0;
+    }
+    return count;
+}
+
+void run_stats::start_phase(char const* name)
+{
+    end_phase();
+    current_phase = name;
+    phase_wall_start = std::chrono::steady_clock::now();
+    phase_cpu_start = std::clock();
+    phase_page_faults_start = page_faults();
+    phase_tlb_misses_start = tlb_misses();
+}
+
+/**
+ * The CPU time is of the whole process, so it includes all the threads.
+ */
+void run_stats::end_phase()
+{
+    if (current_phase == nullptr)
+    {
+        return;
+    }
+    double wall_seconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - phase_wall_start).count();
+    double cpu_seconds = static_cast<double>(std::clock() - phase_cpu_start) / CLOCKS_PER_SEC;
+    int64_t phase_tlb_misses =
+        tlb_misses_fd == -1 ? -1 : static_cast<int64_t>(tlb_misses() - phase_tlb_misses_start);
+    phases.push_back(
+        {current_phase, wall_seconds, cpu_seconds, page_faults() - phase_page_faults_start,
+         phase_tlb_misses}
+    );
+    current_phase = nullptr;
+}
+
+/**
+ * The counters that are not collected or don't apply are `null`.
+ */
+void run_stats::write(FILE* file) const
+{
+    fprintf(file, "{\n  \"phases\": [");
+    for (size_t i = 0; i < phases.size(); ++i)
+    {
+        phase const& phase = phases[i];
+        fprintf(
+            file,
+            "%s\n    {\"name\": \"%s\", \"wall_seconds\": %.6f, \"cpu_seconds\": %.6f, "
+            "\"page_faults\": %llu, \"tlb_misses\": ",
+            i == 0 ? "" : ",", phase.name, phase.wall_seconds, phase.cpu_seconds,
+            static_cast<unsigned long long>(phase.page_faults)
+        );
+        if (phase.tlb_misses < 0)
+        {
+            fprintf(file, "null}");
+        }
+        else
+        {
+            fprintf(file, "%lld}", static_cast<long long>(phase.tlb_misses));
+        }
+    }
+    fprintf(file, "\n  ],\n");
+
+    fprintf(file, "  \"code_bytes\": %llu,\n", static_cast<unsigned long long>(code_bytes));
+    fprintf(
+        file, "  \"instructions_visited\": %llu,\n",
+        static_cast<unsigned long long>(instructions_visited)
+    );
+    if (collect_stats)
+    {
+        fprintf(
+            file, "  \"bytes_decoded\": %llu,\n", static_cast<unsigned long long>(bytes_decoded)
+        );
+    }
+    else
+    {
+        fprintf(file, "  \"bytes_decoded\": null,\n");
+    }
+
+    if (has_table)
+    {
+        fprintf(
+            file,
+            "  \"hashtable\": {\"size\": %llu, \"unique_keys\": %llu, \"load_factor\": %.4f, "
+            "\"grows\": %llu},\n",
+            static_cast<unsigned long long>(table_size),
+            static_cast<unsigned long long>(unique_keys),
+            table_size == 0 ? 0.0 : static_cast<double>(unique_keys) / table_size,
+            static_cast<unsigned long long>(table_grows)
+        );
+    }
+    else
+    {
+        fprintf(file, "  \"hashtable\": null,\n");
+    }
+
+    if (collect_stats && has_table)
+    {
+        fprintf(
+            file, "  \"probes\": {\"lookups\": %llu, \"lengths\": {",
+            static_cast<unsigned long long>(probes.lookups)
+        );
+        bool is_first = true;
+        for (unsigned i = 0; i < probe_stats::buckets; ++i)
+        {
+            if (probes.probe_lengths[i] != 0)
+            {
+                unsigned long long low = 1ull << i;
+                unsigned long long high = (low << 1) - 1;
+                fprintf(file, is_first ? "" : ", ");
+                if (low == high)
+                {
+                    fprintf(file, "\"%llu\": ", low);
+                }
+                else
+                {
+                    fprintf(file, "\"%llu-%llu\": ", low, high);
+                }
+                fprintf(file, "%llu", static_cast<unsigned long long>(probes.probe_lengths[i]));
+                is_first = false;
+            }
+        }
+        fprintf(
+            file, "}, \"equals_calls\": %llu, \"equals_mismatches\": %llu},\n",
+            static_cast<unsigned long long>(probes.equals_calls),
+            static_cast<unsigned long long>(probes.equals_mismatches)
+        );
+    }
+    else
+    {
+        fprintf(file, "  \"probes\": null,\n");
+    }
+
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    fprintf(
+        file, "  \"peak_rss_bytes\": %llu\n}\n",
+        static_cast<unsigned long long>(usage.ru_maxrss) * 1024
+    );
+}
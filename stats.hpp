@@ -0,0 +1,139 @@
+#ifndef STATS_HPP
+#define STATS_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <vector>
+
+/**
+ * The counters on the hot paths are only collected
+ * in builds configured with `-DCOLLECT_STATS=ON`.
+ * Otherwise they compile to nothing, and `--stats` reports
+ * only what is known without them.
+ */
+#ifdef COLLECT_STATS
+constexpr bool collect_stats = true;
+#else
+constexpr bool collect_stats = false;
+#endif
+
+/**
+ * Counters of the lookups in a single hashtable.
+ */
+struct probe_stats
+{
+    /**
+     * `probe_lengths[i]` is the number of lookups
+     * that have inspected from `2^i` to `2^(i + 1) - 1` slots.
+     */
+    static constexpr unsigned buckets = 64;
+
+    uint64_t lookups = 0;
+    uint64_t probe_lengths[buckets] = {};
+    uint64_t equals_calls = 0;
+    uint64_t equals_mismatches = 0;
+
+    void record_lookup(uint64_t probes)
+    {
+        if (collect_stats)
+        {
+            ++lookups;
+            ++probe_lengths[63 - __builtin_clzll(probes)];
+        }
+    }
+
+    void record_equals(bool is_equal)
+    {
+        if (collect_stats)
+        {
+            ++equals_calls;
+            equals_mismatches += !is_equal;
+        }
+    }
+
+    void add(probe_stats const& other);
+};
+
+/**
+ * What `--stats` writes to stderr as a JSON object.
+ */
+struct run_stats
+{
+    struct phase
+    {
+        char const* name;
+        double wall_seconds;
+        double cpu_seconds;
+
+        /**
+         * Minor and major page faults of the process.
+         */
+        uint64_t page_faults;
+
+        /**
+         * Data TLB misses, or -1 if they are not counted.
+         */
+        int64_t tlb_misses;
+    };
+
+    std::vector<phase> phases;
+
+    uint64_t code_bytes = 0;
+    uint64_t instructions_visited = 0;
+
+    /**
+     * Collected only with `COLLECT_STATS`.
+     */
+    uint64_t bytes_decoded = 0;
+
+    /**
+     * The table that is printed, after packing.
+     * There is none in the opcode mode.
+     */
+    bool has_table = false;
+    uint64_t table_size = 0;
+    uint64_t unique_keys = 0;
+    uint64_t table_grows = 0;
+
+    /**
+     * Of all the tables of the run.
+     */
+    probe_stats probes;
+
+    run_stats() = default;
+
+    run_stats(run_stats const&) = delete;
+
+    run_stats& operator=(run_stats const&) = delete;
+
+    ~run_stats();
+
+    /**
+     * Starts counting the data TLB misses of the process and the threads it starts later,
+     * if the kernel and the hardware allow it.
+     */
+    void count_tlb_misses();
+
+    /**
+     * Ends the current phase, if any, and starts a new one.
+     */
+    void start_phase(char const* name);
+
+    void end_phase();
+
+    void write(FILE* file) const;
+
+  private:
+    char const* current_phase = nullptr;
+    std::chrono::steady_clock::time_point phase_wall_start;
+    std::clock_t phase_cpu_start = 0;
+    uint64_t phase_page_faults_start = 0;
+    int tlb_misses_fd = -1;
+    uint64_t phase_tlb_misses_start = 0;
+
+    uint64_t tlb_misses() const;
+};
+
+#endif
@@ -1,13 +1,13 @@
+import json
 import sys
 import os
 import subprocess
 import struct
+import tempfile
 import instructions
 
 
-def test_file(file):
-    print(f"Testing file: {file}")
-
+def expected_occurrences(file, max_length=2, opcodes_only=False):
     worklist = []
     with open(file, "rb") as f:
         stringtab_size = struct.unpack("i", f.read(4))[0]
@@ -42,31 +42,31 @@ def test_file(file):
                 break
 
     occurrences = {}
-    insn = []
+    # The sequences the current instruction continues, the shortest first.
+    sequences = []
     for ip in sorted(visited):
-        prev_insn = insn
-
         opcode = code[ip]
         insn = [opcode]
         _, reader = instructions.by_opcode[opcode]
 
         args, _ = reader(code, ip + 1, worklist)
-        insn.extend(args)
+        if not opcodes_only:
+            insn.extend(args)
 
         insn_bytes = bytes(insn)
-        occurrences[insn_bytes] = occurrences.get(insn_bytes, 0) + 1
-        if ip not in flow_breaks:
-            consecutive = bytes(prev_insn) + insn_bytes
-            occurrences[consecutive] = occurrences.get(consecutive, 0) + 1
+        if ip in flow_breaks:
+            sequences = []
+        sequences = [sequence + insn_bytes for sequence in sequences]
+        for sequence in [insn_bytes] + sequences:
+            occurrences[sequence] = occurrences.get(sequence, 0) + 1
+        sequences = ([insn_bytes] + sequences)[: max_length - 1]
 
-    process = subprocess.Popen(
-        ["build/lama-insnfreq-analysis", "--input", file, "--threshold", "1"],
-        stdout=subprocess.PIPE,
-        stderr=subprocess.PIPE,
-        text=True,
-    )
-    actual_output, stderr = process.communicate()
-    for line in actual_output.splitlines():
+    return occurrences
+
+
+def check_report(lines, occurrences, opcodes_only=False):
+    occurrences = dict(occurrences)
+    for line in lines:
         parts = line.split()
         actual_occurrences = int(parts.pop(0))
         parts.pop(0)
@@ -75,7 +75,7 @@ def test_file(file):
         while i < len(parts):
             if parts[i] in instructions.by_mnemonic:
                 insn.append(instructions.by_mnemonic[parts[i]][0])
-                if parts[i] == "CLOSURE":
+                if parts[i] == "CLOSURE" and not opcodes_only:
                     args_size = int(parts[i + 2], 10)
                     insn.extend(int.to_bytes(int(parts[i + 1], 10), 4, "little"))
                     insn.extend(int.to_bytes(args_size, 4, "little"))
@@ -108,6 +108,201 @@ def test_file(file):
     return False
 
 
+def test_file(file, extra_args):
+    print(f"Testing file: {file} {' '.join(extra_args)}")
+
+    max_length = 2
+    if "--max-length" in extra_args:
+        max_length = int(extra_args[extra_args.index("--max-length") + 1])
+    opcodes_only = "opcodes" in extra_args
+    occurrences = expected_occurrences(file, max_length, opcodes_only)
+    process = subprocess.Popen(
+        ["build/lama-insnfreq-analysis", "--input", file, "--threshold", "1"] + extra_args,
+        stdout=subprocess.PIPE,
+        stderr=subprocess.PIPE,
+        text=True,
+    )
+    actual_output, stderr = process.communicate()
+    lines = actual_output.splitlines()
+    if "--stats" in extra_args and check_stats(stderr, len(lines)):
+        return True
+    return check_report(lines, occurrences, opcodes_only)
+
+
+def check_stats(stderr, printed_entries):
+    stats = json.loads(stderr)
+    phases = [phase["name"] for phase in stats["phases"]]
+    if phases != ["read", "find_reachable", "count", "pack", "print"]:
+        print(f"Unexpected phases: {phases}")
+        return True
+    if stats["hashtable"]["unique_keys"] != printed_entries:
+        print(f"{stats['hashtable']['unique_keys']} unique keys, {printed_entries} printed")
+        return True
+    return False
+
+
+def test_profile(file):
+    print(f"Testing profile of file: {file}")
+
+    def run(args):
+        return subprocess.run(
+            ["build/lama-insnfreq-analysis"] + args, stdout=subprocess.PIPE, text=True
+        ).stdout
+
+    with tempfile.TemporaryDirectory() as directory:
+        profile = os.path.join(directory, "profile")
+        saved = run(["--input", file, "--threshold", "1", "--save-profile", profile])
+        if check_report(saved.splitlines(), expected_occurrences(file)):
+            return True
+        for args in [["--threshold", "2"], ["--top", "5", "--format", "json"]]:
+            expected = run(["--input", file] + args)
+            for source in [["--input", file], []]:
+                if run(source + ["--load-profile", profile] + args) != expected:
+                    print(f"Profile report differs: {' '.join(source + args)}")
+                    return True
+    return False
+
+
+def test_stdin(file):
+    print(f"Testing stdin of file: {file}")
+
+    with open(file, "rb") as input:
+        content = input.read()
+    # The content goes through a pipe, which can't be mapped or seeked.
+    process = subprocess.run(
+        ["build/lama-insnfreq-analysis", "--input", "-", "--threshold", "1"],
+        input=content,
+        stdout=subprocess.PIPE,
+    )
+    return check_report(process.stdout.decode().splitlines(), expected_occurrences(file))
+
+
+def test_memory_limit(file):
+    print(f"Testing tiny memory limits of file: {file}")
+
+    for args in [
+        ["--memory-limit", "12"],
+        ["--memory-limit", "100", "--threads", "4"],
+        ["--memory-limit", "12", "--pair-ids"],
+    ]:
+        try:
+            process = subprocess.run(
+                ["build/lama-insnfreq-analysis", "--input", file] + args,
+                stdout=subprocess.DEVNULL,
+                stderr=subprocess.PIPE,
+                text=True,
+                timeout=60,
+            )
+        except subprocess.TimeoutExpired:
+            print(f"Timed out: {' '.join(args)}")
+            return True
+        if process.returncode == 0 or "memory limit" not in process.stderr:
+            print(f"Expected a memory limit failure: {' '.join(args)}")
+            return True
+    return False
+
+
+def test_overlapping_instructions():
+    print("Testing jumps into operands")
+
+    # Every CJMP_Z jumps into the operand of the CONST after it,
+    # which decodes as ADD ADD DROP DUP.
+    code = bytearray()
+    for _ in range(20000):
+        start = len(code)
+        code += bytes([0x50]) + (start + 6).to_bytes(4, "little")
+        code += bytes([0x10, 0x01, 0x01, 0x18, 0x19])
+    code += bytes([0x16])
+    header = (0).to_bytes(4, "little") * 2 + (1).to_bytes(4, "little")
+    public_area = (0).to_bytes(4, "little") * 2
+
+    with tempfile.TemporaryDirectory() as directory:
+        file = os.path.join(directory, "overlapping.bc")
+        with open(file, "wb") as output:
+            output.write(header + public_area + code)
+        for args in [[], ["--max-length", "3"], ["--mode", "opcodes"], ["--pair-ids"]]:
+            outputs = set()
+            for threads in ["1", "3", "4", "7"]:
+                outputs.add(
+                    subprocess.run(
+                        ["build/lama-insnfreq-analysis", "--input", file, "--threads", threads]
+                        + args,
+                        stdout=subprocess.PIPE,
+                    ).stdout
+                )
+            if len(outputs) != 1:
+                print(f"Output depends on the number of threads: {' '.join(args)}")
+                return True
+    return False
+
+
+def test_corpus(files):
+    print(f"Testing corpus of {len(files)} files")
+
+    total = {}
+    for file in files:
+        for insn, count in expected_occurrences(file).items():
+            total[insn] = total.get(insn, 0) + count
+
+    process = subprocess.Popen(
+        ["build/lama-insnfreq-analysis", "--threshold", "1", "--threads", "4", "--inputs"]
+        + files,
+        stdout=subprocess.PIPE,
+        stderr=subprocess.PIPE,
+        text=True,
+    )
+    actual_output, stderr = process.communicate()
+    lines = actual_output.splitlines()
+    if check_report(lines[lines.index("# total") + 1 :], total):
+        return True
+
+    # All the reports make up a single JSON document.
+    json_output = subprocess.run(
+        ["build/lama-insnfreq-analysis", "--threshold", "1", "--format", "json", "--inputs"]
+        + files,
+        stdout=subprocess.PIPE,
+        text=True,
+    ).stdout
+    reports = json.loads(json_output)
+    if [report["name"] for report in reports] != files + ["total"]:
+        print("Unexpected names of the JSON reports")
+        return True
+    if sum(entry["count"] for entry in reports[-1]["entries"]) != sum(total.values()):
+        print("Unexpected total counts in the JSON report")
+        return True
+    return False
+
+
+def test_merge(files):
+    print(f"Testing merge of {len(files)} files")
+
+    total = {}
+    for file in files:
+        for insn, count in expected_occurrences(file).items():
+            total[insn] = total.get(insn, 0) + count
+
+    def run(args):
+        return subprocess.run(
+            ["build/lama-insnfreq-analysis"] + args, stdout=subprocess.PIPE, text=True
+        ).stdout.splitlines()
+
+    with tempfile.TemporaryDirectory() as directory:
+        profiles = []
+        for i, file in enumerate(files):
+            profiles.append(os.path.join(directory, f"{i}.merge"))
+            run(["--input", file, "--save-mergeable", profiles[-1]])
+        # Merged profiles are merged again, as the parts of a distributed run would be.
+        halves = [os.path.join(directory, "first.merge"), os.path.join(directory, "second.merge")]
+        middle = len(profiles) // 2
+        run(["--merge"] + profiles[:middle] + ["--save-mergeable", halves[0]])
+        run(["--merge"] + profiles[middle:] + ["--save-mergeable", halves[1]])
+
+        if check_report(run(["--merge"] + halves), total):
+            return True
+        frequent = {insn: count for insn, count in total.items() if count >= 100}
+        return check_report(run(["--threshold", "100", "--merge"] + halves), frequent)
+
+
 test_files = [
     dir + "/" + f
     for dir in [
@@ -120,6 +315,36 @@ test_files = [
     if f.endswith(".bc")
 ]
 
+test_args = [
+    [],
+    ["--threads", "4"],
+    ["--max-length", "1"],
+    ["--stats"],
+    ["--max-length", "4"],
+    ["--max-length", "4", "--threads", "4"],
+    ["--pair-ids"],
+    ["--pair-ids", "--threads", "4"],
+    ["--pair-ids", "--max-length", "1"],
+    ["--mode", "opcodes", "--max-length", "3"],
+    ["--mode", "opcodes", "--max-length", "3", "--threads", "4"],
+]
+
 for filename in sorted(test_files):
-    if test_file(filename):
+    for extra_args in test_args:
+        if test_file(filename, extra_args):
+            sys.exit(1)
+    if test_profile(filename):
+        sys.exit(1)
+    if test_stdin(filename):
         sys.exit(1)
+    if test_memory_limit(filename):
+        sys.exit(1)
+
+if test_overlapping_instructions():
+    sys.exit(1)
+
+if test_corpus(sorted(test_files)):
+    sys.exit(1)
+
+if test_merge(sorted(test_files)):
+    sys.exit(1)